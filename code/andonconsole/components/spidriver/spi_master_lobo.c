@@ -64,6 +64,10 @@ Main driver's function is 'spi_lobo_transfer_data()'
 #include "soc/dport_reg.h"
 #include "esp_log.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_memory_utils.h"
+#include "esp_timer.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
 #include "spi_master_lobo.h"
@@ -186,7 +190,7 @@ typedef void(*dmaworkaround_cb_t)(void *arg);
 
 //Set up a list of dma descriptors. dmadesc is an array of descriptors. Data is the buffer to point to.
 //--------------------------------------------------------------------------------------------
-void spi_lobo_setup_dma_desc_links(lldesc_t *dmadesc, int len, const uint8_t *data, bool isrx)
+void IRAM_ATTR spi_lobo_setup_dma_desc_links(lldesc_t *dmadesc, int len, const uint8_t *data, bool isrx)
 {
     int n = 0;
     while (len) {
@@ -338,6 +342,109 @@ bool spi_lobo_dma_chan_free(int dma_chan)
 //======================================================================================================
 
 
+// Reset the DMA after a transfer
+//-----------------------------------------------------
+static void IRAM_ATTR spi_lobo_dma_reset(spi_lobo_host_t *host)
+{
+    host->hw->dma_conf.val |= SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST;
+    host->hw->dma_out_link.start=0;
+    host->hw->dma_in_link.start=0;
+    host->hw->dma_conf.val &= ~(SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST);
+    host->hw->dma_conf.out_data_burst_en=1;
+}
+
+// Start sending the queued transaction 'host->cur_trans' with DMA
+//--------------------------------------------------------
+static void IRAM_ATTR spi_lobo_trans_start(spi_lobo_host_t *host)
+{
+    spi_lobo_transaction_t *trans = host->cur_trans;
+    spi_lobo_device_t *dev = host->device[host->cur_device];
+    const uint8_t *txbuffer = (trans->flags & LB_SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+    uint32_t txlen = trans->length / 8;
+
+    if (dev->cfg.pre_cb) dev->cfg.pre_cb(trans);
+
+    host->hw->user2.usr_command_value=trans->command;
+    if (dev->cfg.address_bits>32) {
+        host->hw->addr=trans->address >> 32;
+        host->hw->slv_wr_status=trans->address & 0xffffffff;
+    } else {
+        host->hw->addr=trans->address & 0xffffffff;
+    }
+    host->hw->user.usr_miso=0;
+    host->hw->miso_dlen.usr_miso_dbitlen=0;
+    host->hw->user.usr_mosi=1;
+
+    spi_lobo_dmaworkaround_transfer_active(host->dma_chan); //mark channel as active
+    spi_lobo_setup_dma_desc_links(host->dmadesc_tx, txlen, txbuffer, false);
+    host->hw->user.usr_mosi_highpart=0;
+    host->hw->dma_out_link.addr=(int)(&host->dmadesc_tx[0]) & 0xFFFFF;
+    host->hw->dma_out_link.start=1;
+    host->hw->mosi_dlen.usr_mosi_dbitlen=(txlen*8)-1;
+
+    // Start transfer
+    host->hw->cmd.usr=1;
+}
+
+// Transaction done interrupt
+// While there are queued transactions, it finishes the one sent and starts the next one.
+// Otherwise it is enabled only while a task waits in spi_lobo_wait_trans_done().
+//-----------------------------------------------
+static void IRAM_ATTR spi_lobo_intr(void *arg)
+{
+    spi_lobo_host_t *host = (spi_lobo_host_t *)arg;
+    spi_lobo_transaction_t *trans;
+    BaseType_t woken = pdFALSE;
+
+    if (!host->hw->slave.trans_done) return;
+    host->hw->slave.trans_done = 0;
+
+    if (!host->queue_active) {
+        host->hw->slave.trans_inten = 0;
+        xSemaphoreGiveFromISR(host->trans_done_sem, &woken);
+        if (woken == pdTRUE) portYIELD_FROM_ISR();
+        return;
+    }
+
+    if (host->cur_trans) {
+        // Queued transaction sent, return it to the device
+        spi_lobo_device_t *dev = host->device[host->cur_device];
+        trans = host->cur_trans;
+        host->cur_trans = NULL;
+        spi_lobo_dmaworkaround_idle(host->dma_chan);
+        spi_lobo_dma_reset(host);
+        if (dev->cfg.post_cb) dev->cfg.post_cb(trans);
+        xQueueSendFromISR(dev->ret_queue, &trans, &woken);
+    }
+
+    portENTER_CRITICAL_ISR(&host->queue_mux);
+    if (xQueueReceiveFromISR(host->trans_queue, &trans, &woken) == pdTRUE) {
+        host->cur_trans = trans;
+    }
+    else {
+        // Queue empty, the bus is free again
+        host->hw->slave.trans_inten = 0;
+        host->queue_active = false;
+    }
+    portEXIT_CRITICAL_ISR(&host->queue_mux);
+
+    if (host->cur_trans) spi_lobo_trans_start(host);
+    else xSemaphoreGiveFromISR(host->queue_idle_sem, &woken);
+    if (woken == pdTRUE) portYIELD_FROM_ISR();
+}
+
+// Wait until the interrupt has sent all queued transactions, blocking on the
+// semaphore it gives when done. Transactions are only queued from tasks while
+// the scheduler runs (see spi_lobo_queue_trans), so this never needs to spin.
+//-------------------------------------------------------------
+static void IRAM_ATTR spi_lobo_queue_wait_idle(spi_lobo_host_t *host)
+{
+    // A token left by an earlier idle only costs one more check
+    while (host->queue_active) {
+        xSemaphoreTake(host->queue_idle_sem, pdMS_TO_TICKS(SPI_SEMAPHORE_WAIT));
+    }
+}
+
 //----------------------------------------------------------------------------------------------------------------
 static esp_err_t spi_lobo_bus_initialize(spi_lobo_host_device_t host, spi_lobo_bus_config_t *bus_config, int init)
 {
@@ -371,6 +478,13 @@ static esp_err_t spi_lobo_bus_initialize(spi_lobo_host_device_t host, spi_lobo_b
 		// Create semaphore
 		spihost[host]->spi_lobo_bus_mutex = xSemaphoreCreateMutex();
 		if (!spihost[host]->spi_lobo_bus_mutex) return ESP_ERR_NO_MEM;
+		spihost[host]->trans_done_sem = xSemaphoreCreateBinary();
+		if (!spihost[host]->trans_done_sem) return ESP_ERR_NO_MEM;
+		spihost[host]->trans_queue = xQueueCreate(SPI_QUEUE_SIZE, sizeof(spi_lobo_transaction_t *));
+		if (!spihost[host]->trans_queue) return ESP_ERR_NO_MEM;
+		spihost[host]->queue_idle_sem = xSemaphoreCreateBinary();
+		if (!spihost[host]->queue_idle_sem) return ESP_ERR_NO_MEM;
+		portMUX_INITIALIZE(&spihost[host]->queue_mux);
     }
 
     spihost[host]->cur_device = -1;
@@ -466,11 +580,14 @@ static esp_err_t spi_lobo_bus_initialize(spi_lobo_host_device_t host, spi_lobo_b
         spihost[host]->hw->slave.rd_sta_inten=0;
         spihost[host]->hw->slave.wr_sta_inten=0;
 
-        //Force a transaction done interrupt. This interrupt won't fire yet because we initialized the SPI interrupt as
-        //disabled.  This way, we can just enable the SPI interrupt and the interrupt handler will kick in, handling
-        //any transactions that are queued.
-        spihost[host]->hw->slave.trans_inten=1;
-        spihost[host]->hw->slave.trans_done=1;
+        //Transaction done interrupt, enabled by spi_lobo_wait_trans_done() while it waits
+        //and by spi_lobo_queue_trans() while there are queued transactions
+        spihost[host]->hw->slave.trans_inten=0;
+        spihost[host]->hw->slave.trans_done=0;
+        if (esp_intr_alloc(io_signal[host].irq, ESP_INTR_FLAG_IRAM, spi_lobo_intr, spihost[host], &spihost[host]->intr) != ESP_OK) {
+            //Waiting polls the bus without it
+            spihost[host]->intr = NULL;
+        }
 
 		//Select DMA channel.
 		DPORT_SET_PERI_REG_BITS(DPORT_SPI_DMA_CHAN_SEL_REG, 3, init, (host * 2));
@@ -507,6 +624,10 @@ static esp_err_t spi_lobo_bus_free(spi_lobo_host_device_t host, int dofree)
     spi_lobo_periph_free(host);
 
     if (dofree) {
+		if (spihost[host]->intr) esp_intr_free(spihost[host]->intr);
+		vSemaphoreDelete(spihost[host]->trans_done_sem);
+		vQueueDelete(spihost[host]->trans_queue);
+		vSemaphoreDelete(spihost[host]->queue_idle_sem);
 		vSemaphoreDelete(spihost[host]->spi_lobo_bus_mutex);
 	    free(spihost[host]->dmadesc_tx);
 	    free(spihost[host]->dmadesc_rx);
@@ -563,6 +684,12 @@ esp_err_t spi_lobo_bus_add_device(spi_lobo_host_device_t host, spi_lobo_bus_conf
     if (dev==NULL) return ESP_ERR_NO_MEM;
 
     memset(dev, 0, sizeof(spi_lobo_device_t));
+    dev->ret_queue = xQueueCreate(SPI_QUEUE_SIZE, sizeof(spi_lobo_transaction_t *));
+    if (dev->ret_queue == NULL) {
+        spihost[host]->device[freecs]=NULL;
+        free(dev);
+        return ESP_ERR_NO_MEM;
+    }
     spihost[host]->device[freecs]=dev;
 
     if (dev_config->duty_cycle_pos==0) dev_config->duty_cycle_pos=128;
@@ -620,6 +747,7 @@ esp_err_t spi_lobo_bus_remove_device(spi_lobo_device_handle_t handle)
 	for (x=0; x<NO_DEV; x++) {
 		if (spihost[handle->host_dev]->device[x] !=NULL) break;
 	}
+	vQueueDelete(handle->ret_queue);
 	if (x == NO_DEV) {
 		spi_lobo_bus_free(handle->host_dev, 1);
 		free(handle);
@@ -693,6 +821,49 @@ static int IRAM_ATTR spi_set_clock(spi_dev_t *hw, int fapb, int hz, int duty_cyc
 
 
 
+// Check if a device with higher priority than 'handle' waits for the bus
+//-------------------------------------------------------------------------
+static bool IRAM_ATTR spi_lobo_higher_waiting(spi_lobo_device_handle_t handle)
+{
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+
+	for (int i=0; i<NO_DEV; i++) {
+		spi_lobo_device_t *dev = host->device[i];
+		if ((dev) && (dev != handle) && (dev->waiting) && (dev->cfg.priority > handle->cfg.priority)) return true;
+	}
+	return false;
+}
+
+// Take the bus mutex, after the waiting devices with higher priority
+//---------------------------------------------------------------------
+static esp_err_t IRAM_ATTR spi_lobo_bus_take(spi_lobo_device_handle_t handle)
+{
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	int64_t t_start = esp_timer_get_time();
+	uint32_t wait_us;
+
+	handle->waiting = 1;
+	while (1) {
+		if (!(xSemaphoreTake(host->spi_lobo_bus_mutex, SPI_SEMAPHORE_WAIT))) {
+			handle->waiting = 0;
+			return ESP_ERR_INVALID_STATE;
+		}
+		if (!spi_lobo_higher_waiting(handle)) break;
+		// Let the device with higher priority in first, its task may have lower priority
+		xSemaphoreGive(host->spi_lobo_bus_mutex);
+		vTaskDelay(1);
+	}
+	handle->waiting = 0;
+
+	wait_us = (uint32_t)(esp_timer_get_time() - t_start);
+	handle->stats.selects++;
+	handle->stats.wait_us_last = wait_us;
+	handle->stats.wait_us_total += wait_us;
+	if (wait_us > handle->stats.wait_us_max) handle->stats.wait_us_max = wait_us;
+
+	return ESP_OK;
+}
+
 //------------------------------------------------------------------------------------
 esp_err_t IRAM_ATTR spi_lobo_device_select(spi_lobo_device_handle_t handle, int force)
 {
@@ -709,25 +880,29 @@ esp_err_t IRAM_ATTR spi_lobo_device_select(spi_lobo_device_handle_t handle, int
 	}
 	if (i == NO_DEV) return ESP_ERR_INVALID_ARG;
 
-	if (!(xSemaphoreTake(host->spi_lobo_bus_mutex, SPI_SEMAPHORE_WAIT))) return ESP_ERR_INVALID_STATE;
-
-	// Check if previously used device's bus device is the same
-	if (memcmp(&host->cur_bus_config, &handle->bus_config, sizeof(spi_lobo_bus_config_t)) != 0) {
-		// device has different bus configuration, we need to reconfigure the bus
-		esp_err_t err = spi_lobo_bus_free(1, 0);
-		if (err) {
-			xSemaphoreGive(host->spi_lobo_bus_mutex);
-			return err;
-		}
-		err = spi_lobo_bus_initialize(i, &handle->bus_config, -1);
-		if (err) {
-			xSemaphoreGive(host->spi_lobo_bus_mutex);
-			return err;
-		}
-	}
+	esp_err_t ret = spi_lobo_bus_take(handle);
+	if (ret) return ret;
 
 	//Reconfigure according to device settings, but only if the device changed or forced.
+	// The same device selected again skips the bus configuration check too.
 	if ((force) || (host->device[host->cur_device] != handle)) {
+		handle->stats.reconfigs++;
+
+		// Check if previously used device's bus device is the same
+		if (memcmp(&host->cur_bus_config, &handle->bus_config, sizeof(spi_lobo_bus_config_t)) != 0) {
+			// device has different bus configuration, we need to reconfigure the bus
+			esp_err_t err = spi_lobo_bus_free(1, 0);
+			if (err) {
+				xSemaphoreGive(host->spi_lobo_bus_mutex);
+				return err;
+			}
+			err = spi_lobo_bus_initialize(i, &handle->bus_config, -1);
+			if (err) {
+				xSemaphoreGive(host->spi_lobo_bus_mutex);
+				return err;
+			}
+		}
+
 	    //Assumes a hardcoded 80MHz Fapb for now. ToDo: figure out something better once we have clock scaling working.
 		int apbclk=APB_CLK_FREQ;
 
@@ -823,6 +998,9 @@ esp_err_t IRAM_ATTR spi_lobo_device_deselect(spi_lobo_device_handle_t handle)
 		if (host->device[i] == handle) break;
 	}
 	if (i == NO_DEV) return ESP_ERR_INVALID_ARG;
+
+	// Queued transactions are sent with the device selected
+	spi_lobo_queue_wait_idle(host);
 	
 	if (host->device[host->cur_device] == handle) {
 		if ((handle->cfg.spics_io_num < 0) && (handle->cfg.spics_ext_io_num > 0)) {
@@ -836,6 +1014,30 @@ esp_err_t IRAM_ATTR spi_lobo_device_deselect(spi_lobo_device_handle_t handle)
 	return ESP_OK;
 }
 
+//--------------------------------------------------------------------------
+esp_err_t IRAM_ATTR spi_lobo_device_yield(spi_lobo_device_handle_t handle, bool *yielded)
+{
+	if (yielded) *yielded = false;
+	if (handle == NULL) return ESP_ERR_INVALID_ARG;
+	if ((handle->cfg.selected == 0) || (!spi_lobo_higher_waiting(handle))) return ESP_OK;
+
+	handle->stats.yields++;
+	if (yielded) *yielded = true;
+	esp_err_t ret = spi_lobo_device_deselect(handle);
+	if (ret) return ret;
+	return spi_lobo_device_select(handle, 0);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+esp_err_t spi_lobo_device_get_stats(spi_lobo_device_handle_t handle, spi_lobo_device_stats_t *stats, bool reset)
+{
+	if ((handle == NULL) || (stats == NULL)) return ESP_ERR_INVALID_ARG;
+
+	*stats = handle->stats;
+	if (reset) memset(&handle->stats, 0, sizeof(spi_lobo_device_stats_t));
+	return ESP_OK;
+}
+
 //--------------------------------------------------------------------------------
 esp_err_t IRAM_ATTR spi_lobo_device_TakeSemaphore(spi_lobo_device_handle_t handle)
 {
@@ -849,6 +1051,81 @@ void IRAM_ATTR spi_lobo_device_GiveSemaphore(spi_lobo_device_handle_t handle)
 	xSemaphoreTake(handle->host->spi_lobo_bus_mutex, portMAX_DELAY);
 }
 
+//------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR spi_lobo_wait_trans_done(spi_lobo_device_handle_t handle)
+{
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	esp_err_t ret = ESP_OK;
+
+	spi_lobo_queue_wait_idle(host);
+	if (host->hw->cmd.usr == 0) return ESP_OK;
+
+	if ((host->intr == NULL) || (xPortInIsrContext()) || (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)) {
+		while (host->hw->cmd.usr);
+		return ESP_OK;
+	}
+
+	host->hw->slave.trans_done = 0;
+	host->hw->slave.trans_inten = 1;
+	// if it finished before the interrupt was enabled, nothing may be signalled
+	if (host->hw->cmd.usr) {
+		if (xSemaphoreTake(host->trans_done_sem, pdMS_TO_TICKS(SPI_SEMAPHORE_WAIT)) != pdTRUE) ret = ESP_ERR_TIMEOUT;
+	}
+	host->hw->slave.trans_inten = 0;
+	xSemaphoreTake(host->trans_done_sem, 0);	// drop a signal given after the check
+	if (ret == ESP_OK) while (host->hw->cmd.usr);
+
+	return ret;
+}
+
+//-----------------------------------------------------------------------------------------
+esp_err_t spi_lobo_queue_trans(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans)
+{
+	if ((handle == NULL) || (trans == NULL)) return ESP_ERR_INVALID_ARG;
+
+	spi_lobo_host_t *host=(spi_lobo_host_t*)handle->host;
+	const uint8_t *txbuffer = (trans->flags & LB_SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+	uint32_t txlen = trans->length / 8;
+
+	// Transmit only, from DMA capable memory, in one DMA transfer
+	if ((txbuffer == NULL) || (txlen == 0) || ((trans->length % 8) != 0) || (txlen > host->max_transfer_sz)) return ESP_ERR_INVALID_ARG;
+	if ((trans->flags & LB_SPI_TRANS_USE_TXDATA) && (txlen > 4)) return ESP_ERR_INVALID_ARG;
+	if ((trans->rxlength > 0) || (!esp_ptr_dma_capable(txbuffer))) return ESP_ERR_INVALID_ARG;
+	if ((host->dma_chan == 0) || (host->intr == NULL)) return ESP_ERR_NOT_SUPPORTED;
+	// Waiting for the queue blocks the task
+	if ((xPortInIsrContext()) || (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)) return ESP_ERR_INVALID_STATE;
+	if ((handle->cfg.selected == 0) || (handle->trans_pending >= SPI_QUEUE_SIZE)) return ESP_ERR_INVALID_STATE;
+
+	// A transfer started directly may still be running
+	if (!host->queue_active) spi_lobo_wait_trans_done(handle);
+
+	// Only the selected device queues, so there is always room
+	handle->trans_pending++;
+	xQueueSend(host->trans_queue, &trans, 0);
+
+	portENTER_CRITICAL(&host->queue_mux);
+	if (!host->queue_active) {
+		// Raise the transaction done interrupt, it starts the first transaction
+		host->queue_active = true;
+		host->hw->slave.trans_done = 1;
+		host->hw->slave.trans_inten = 1;
+	}
+	portEXIT_CRITICAL(&host->queue_mux);
+
+	return ESP_OK;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+esp_err_t spi_lobo_get_trans_result(spi_lobo_device_handle_t handle, spi_lobo_transaction_t **trans, TickType_t ticks_to_wait)
+{
+	if ((handle == NULL) || (trans == NULL)) return ESP_ERR_INVALID_ARG;
+
+	if (xQueueReceive(handle->ret_queue, trans, ticks_to_wait) != pdTRUE) return ESP_ERR_TIMEOUT;
+	handle->trans_pending--;
+
+	return ESP_OK;
+}
+
 //----------------------------------------------------------
 uint32_t spi_lobo_get_speed(spi_lobo_device_handle_t handle)
 {
@@ -947,6 +1224,7 @@ esp_err_t IRAM_ATTR spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_
 	if ((rxbuffer == &trans->rx_data[0]) && (rxlen > 4)) return ESP_ERR_INVALID_ARG;
 
 	// --- Wait for SPI bus ready ---
+	spi_lobo_queue_wait_idle(host);
 	while (host->hw->cmd.usr);
 
     // ** If the device was not selected, select it
@@ -89,8 +89,9 @@ typedef struct {
     int spics_io_num;                   ///< CS GPIO pin for this device, handled by hardware; set to -1 if not used
     int spics_ext_io_num;               ///< CS GPIO pin for this device, handled by software (spi_lobo_device_select/spi_lobo_device_deselect); only used if spics_io_num=-1
     uint32_t flags;                     ///< Bitwise OR of LB_SPI_DEVICE_* flags
-    spi_lobo_transaction_cb_t pre_cb;   ///< Callback to be called before a transmission is started. This callback from 'spi_lobo_transfer_data' function.
-    spi_lobo_transaction_cb_t post_cb;  ///< Callback to be called after a transmission has completed. This callback from 'spi_lobo_transfer_data' function.
+    uint8_t priority;                   ///< Bus arbitration priority; devices waiting for the bus are let in before those with lower priority
+    spi_lobo_transaction_cb_t pre_cb;   ///< Callback to be called before a transmission is started. This callback from 'spi_lobo_transfer_data' function, or from the interrupt for queued transactions (must be in IRAM).
+    spi_lobo_transaction_cb_t post_cb;  ///< Callback to be called after a transmission has completed. This callback from 'spi_lobo_transfer_data' function, or from the interrupt for queued transactions (must be in IRAM).
     uint8_t selected;                   ///< **INTERNAL** 1 if the device's CS pin is active
 } spi_lobo_device_interface_config_t;
 
@@ -124,14 +125,31 @@ struct spi_lobo_transaction_t {
 #define NO_CS 3					    // Number of CS pins per SPI host
 #define NO_DEV 6				    // Number of spi devices per SPI host; more than 3 devices can be attached to the same bus if using software CS's
 #define SPI_SEMAPHORE_WAIT 2000     // Time in ms to wait for SPI mutex
+#define SPI_QUEUE_SIZE 8            // Number of transactions that can be queued per SPI host, see spi_lobo_queue_trans
 
 typedef struct spi_lobo_device_t spi_lobo_device_t;
 
+/**
+ * @brief Bus usage counters of a SPI device, see spi_lobo_device_get_stats
+ */
+typedef struct {
+    uint32_t selects;                   ///< Number of times the device got the bus
+    uint32_t reconfigs;                 ///< Selects that had to reconfigure the bus for the device
+    uint32_t yields;                    ///< Times the device gave the bus to a device with higher priority
+    uint32_t wait_us_last;              ///< Time the last select waited for the bus, in us
+    uint32_t wait_us_max;               ///< Longest time a select waited for the bus, in us
+    uint64_t wait_us_total;             ///< Total time waited for the bus, in us
+} spi_lobo_device_stats_t;
+
 typedef struct {
     spi_lobo_device_t *device[NO_DEV];
     intr_handle_t intr;
     spi_dev_t *hw;
-    //spi_lobo_transaction_t *cur_trans;
+    spi_lobo_transaction_t *cur_trans;  ///< Queued transaction being sent, NULL if none
+    QueueHandle_t trans_queue;          ///< Queued transactions waiting for the bus
+    volatile bool queue_active;         ///< The interrupt is working through trans_queue
+    SemaphoreHandle_t queue_idle_sem;   ///< Given from the interrupt when trans_queue is done
+    portMUX_TYPE queue_mux;             ///< Protects queue_active
     int cur_device;
     lldesc_t *dmadesc_tx;
     lldesc_t *dmadesc_rx;
@@ -139,12 +157,17 @@ typedef struct {
     int dma_chan;
     int max_transfer_sz;
     QueueHandle_t spi_lobo_bus_mutex;
+    SemaphoreHandle_t trans_done_sem;   ///< Given from the transaction done interrupt, see spi_lobo_wait_trans_done
     spi_lobo_bus_config_t cur_bus_config;
 } spi_lobo_host_t;
 
 struct spi_lobo_device_t {
     spi_lobo_device_interface_config_t cfg;
     spi_lobo_host_t *host;
+    QueueHandle_t ret_queue;            ///< Finished queued transactions, see spi_lobo_get_trans_result
+    int trans_pending;                  ///< Queued transactions not yet returned by spi_lobo_get_trans_result
+    volatile uint8_t waiting;           ///< 1 while spi_lobo_device_select waits for the bus
+    spi_lobo_device_stats_t stats;
     spi_lobo_bus_config_t bus_config;
 	spi_lobo_host_device_t host_dev;
 };
@@ -225,12 +248,15 @@ uint32_t spi_lobo_set_speed(spi_lobo_device_handle_t handle, uint32_t speed);
  * If device's spics_io_num=-1 and spics_ext_io_num > 0 'spics_ext_io_num' pin is set to active state (low)
  * 
  * spi bus device's semaphore is taken before selecting the device
+ * While devices with higher priority wait for the bus, they get it first.
+ * If the device is the same as the last selected one, the bus is not reconfigured.
  *
  * @param handle Device handle obtained using spi_lobo_bus_add_device
  * @param force  configure spi bus even if the previous device was the same
  * 
  * @return 
  *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_INVALID_STATE if the bus was not free in SPI_SEMAPHORE_WAIT
  *         - ESP_OK                on success
  */
 esp_err_t spi_lobo_device_select(spi_lobo_device_handle_t handle, int force);
@@ -250,6 +276,38 @@ esp_err_t spi_lobo_device_select(spi_lobo_device_handle_t handle, int force);
  */
 esp_err_t spi_lobo_device_deselect(spi_lobo_device_handle_t handle);
 
+/**
+ * @brief Let a device with higher priority waiting for the bus use it
+ *
+ * Call between the parts of a long transfer, with no transfer in progress.
+ * If a device with higher priority waits for the bus, the device is deselected
+ * and selected again after it, otherwise nothing is done.
+ * The other device's transfers change the transfer registers (MOSI/MISO phases and lengths)
+ * and the DMA state; if '*yielded' is set, set them up again before the next transfer.
+ *
+ * @param handle  Device handle obtained using spi_lobo_bus_add_device, must be selected
+ * @param yielded Set to true if the bus was given to another device; can be NULL
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP error code        if device cannot be selected again; the device does not own the bus then
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_device_yield(spi_lobo_device_handle_t handle, bool *yielded);
+
+/**
+ * @brief Get the bus usage counters of the device
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param stats  Pointer to variable to hold the counters
+ * @param reset  clear the counters after reading them
+ *
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_device_get_stats(spi_lobo_device_handle_t handle, spi_lobo_device_stats_t *stats, bool reset);
+
 
 /**
  * @brief Check if spi bus uses native spi pins
@@ -299,6 +357,61 @@ void spi_lobo_get_native_pins(int host, int *sdi, int *sdo, int *sck);
 esp_err_t spi_lobo_transfer_data(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans);
 
 
+/**
+ * @brief Wait for the transfer in progress on the device's bus to finish
+ *
+ * The calling task blocks until the transaction done interrupt instead of polling the bus,
+ * so the CPU is free while a long DMA transfer is sent.
+ * Polls the bus when called from an ISR or before the scheduler is started.
+ *
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ *
+ * @return
+ *         - ESP_ERR_TIMEOUT       if the transfer did not finish in SPI_SEMAPHORE_WAIT ms
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_wait_trans_done(spi_lobo_device_handle_t handle);
+
+
+/**
+ * @brief Queue a transaction to be sent in the background
+ * The transaction is sent with DMA when the bus is free, the transactions queued before it first.
+ * The interrupt starts each transaction when the previous one is done, calling the device's
+ * pre_cb before and post_cb after it, so the calling task is free while they are sent.
+ * Finished transactions are collected with spi_lobo_get_trans_result.
+ * The device must be selected (spi_lobo_device_select) and stay selected until all its queued
+ * transactions are finished; spi_lobo_device_deselect waits for them.
+ * Only transmit transactions are queued, up to the bus max_transfer_sz bytes, from DMA capable memory.
+ * Use spi_lobo_transfer_data to receive data.
+ * spi_lobo_transfer_data and spi_lobo_wait_trans_done wait for the queued transactions, code that
+ * writes the SPI registers itself must call spi_lobo_wait_trans_done first.
+ * Up to SPI_QUEUE_SIZE transactions can be queued and not yet returned by spi_lobo_get_trans_result.
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param trans Description of the transaction; must stay valid until returned by spi_lobo_get_trans_result
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_INVALID_STATE if the device is not selected, SPI_QUEUE_SIZE transactions are not returned yet,
+ *                                 or not called from a task with the scheduler running
+ *         - ESP_ERR_NOT_SUPPORTED if the bus has no DMA channel or interrupt
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_queue_trans(spi_lobo_device_handle_t handle, spi_lobo_transaction_t *trans);
+
+/**
+ * @brief Get the result of a transaction queued with spi_lobo_queue_trans
+ * Blocks the calling task until one of the device's queued transactions is finished.
+ * Transactions are returned in the order they were queued.
+ * @param handle Device handle obtained using spi_lobo_bus_add_device
+ * @param trans Pointer to variable to hold the finished transaction
+ * @param ticks_to_wait Ticks to wait for a finished transaction, portMAX_DELAY to wait forever
+ * @return
+ *         - ESP_ERR_INVALID_ARG   if parameter is invalid
+ *         - ESP_ERR_TIMEOUT       if no transaction finished before ticks_to_wait expired
+ *         - ESP_OK                on success
+ */
+esp_err_t spi_lobo_get_trans_result(spi_lobo_device_handle_t handle, spi_lobo_transaction_t **trans, TickType_t ticks_to_wait);
+
+
 /*
  * SPI transactions uses the semaphore (taken in select function) to protect the transfer
  */
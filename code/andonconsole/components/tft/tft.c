@@ -114,6 +114,12 @@ static dispWin_t dispWinTemp;
 static uint8_t *userfont = NULL;
 static int TFT_OFFSET = 0;
 static propFont	fontChar;
+
+// Index of the proportional font last measured: offset of each character's
+// data in the font, 0 if the font does not have the character
+static uint8_t *font_index_font = NULL;
+static uint16_t font_index[256];
+static Font font_index_cfont;		// measured sizes of that font
 static float _arcAngleMax = DEFAULT_ARC_ANGLE_MAX;
 
 
@@ -197,8 +203,31 @@ void TFT_drawFastHLine(int16_t x, int16_t y, int16_t w, color_t color) {
 	_drawFastHLine(x+tft_dispWin.x1, y+tft_dispWin.y1, w, color);
 }
 
+// Spans: runs of pixels from x1 to x2 (or y1 to y2), both included,
+// clipped to the display window and written as one address window.
+// Used by the outline primitives in place of one window per pixel.
+// ** Device must already be selected **
+//-----------------------------------------------------------------------
+static void _spanH(int16_t x1, int16_t x2, int16_t y, color_t color) {
+	if ((y < tft_dispWin.y1) || (y > tft_dispWin.y2)) return;
+	if (x1 < tft_dispWin.x1) x1 = tft_dispWin.x1;
+	if (x2 > tft_dispWin.x2) x2 = tft_dispWin.x2;
+	if (x1 > x2) return;
+	send_color(x1, y, x2, y, color, (uint32_t)(x2-x1+1));
+}
+
+//-----------------------------------------------------------------------
+static void _spanV(int16_t x, int16_t y1, int16_t y2, color_t color) {
+	if ((x < tft_dispWin.x1) || (x > tft_dispWin.x2)) return;
+	if (y1 < tft_dispWin.y1) y1 = tft_dispWin.y1;
+	if (y2 > tft_dispWin.y2) y2 = tft_dispWin.y2;
+	if (y1 > y2) return;
+	send_color(x, y1, x, y2, color, (uint32_t)(y2-y1+1));
+}
+
 // Bresenham's algorithm - thx wikipedia - speed enhanced by Bodmer this uses
-// the eficient FastH/V Line draw routine for segments of 2 pixels or more
+// the eficient FastH/V Line draw routine for segments of 2 pixels or more.
+// Segments are sent as spans, with the display selected once per line.
 //----------------------------------------------------------------------------------
 static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color)
 {
@@ -229,6 +258,8 @@ static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t co
 
   if (y0 < y1) ystep = 1;
 
+  if (disp_select() != ESP_OK) return;
+
   // Split into steep and not steep for FastH/V separation
   if (steep) {
     for (; x0 <= x1; x0++) {
@@ -236,12 +267,11 @@ static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t co
       err -= dy;
       if (err < 0) {
         err += dx;
-        if (dlen == 1) _drawPixel(y0, xs, color, 1);
-        else _drawFastVLine(y0, xs, dlen, color);
+        _spanV(y0, xs, xs + dlen - 1, color);
         dlen = 0; y0 += ystep; xs = x0 + 1;
       }
     }
-    if (dlen) _drawFastVLine(y0, xs, dlen, color);
+    if (dlen) _spanV(y0, xs, xs + dlen - 1, color);
   }
   else
   {
@@ -250,13 +280,13 @@ static void _drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t co
       err -= dy;
       if (err < 0) {
         err += dx;
-        if (dlen == 1) _drawPixel(xs, y0, color, 1);
-        else _drawFastHLine(xs, y0, dlen, color);
+        _spanH(xs, xs + dlen - 1, y0, color);
         dlen = 0; y0 += ystep; xs = x0 + 1;
       }
     }
-    if (dlen) _drawFastHLine(xs, y0, dlen, color);
+    if (dlen) _spanH(xs, xs + dlen - 1, y0, color);
   }
+  disp_deselect();
 }
 
 //==============================================================================
@@ -323,6 +353,34 @@ void TFT_drawRect(uint16_t x1,uint16_t y1,uint16_t w,uint16_t h, color_t color)
 	_drawRect(x1+tft_dispWin.x1, y1+tft_dispWin.y1, w, h, color);
 }
 
+// Draw the circle points (xa..xb, yr) of one octant step, mirrored into the
+// quadrants selected by 'corners' (1: top left, 2: top right, 4: bottom right,
+// 8: bottom left): one horizontal and one vertical span per quadrant
+// ** Device must already be selected **
+//--------------------------------------------------------------------------------------------------------------------
+static void _circleSpans(int16_t x0, int16_t y0, int16_t xa, int16_t xb, int16_t yr, uint8_t corners, color_t color)
+{
+	if (xa > xb) return;
+	if (corners & 0x4) {
+		_spanH(x0 + xa, x0 + xb, y0 + yr, color);
+		_spanV(x0 + yr, y0 + xa, y0 + xb, color);
+	}
+	if (corners & 0x2) {
+		_spanH(x0 + xa, x0 + xb, y0 - yr, color);
+		_spanV(x0 + yr, y0 - xb, y0 - xa, color);
+	}
+	if (corners & 0x8) {
+		_spanV(x0 - yr, y0 + xa, y0 + xb, color);
+		_spanH(x0 - xb, x0 - xa, y0 + yr, color);
+	}
+	if (corners & 0x1) {
+		_spanV(x0 - yr, y0 - xb, y0 - xa, color);
+		_spanH(x0 - xb, x0 - xa, y0 - yr, color);
+	}
+}
+
+// Midpoint circle quadrants; the points sharing a 'y' are collected
+// into runs [xs, x] and drawn as spans by _circleSpans()
 //-------------------------------------------------------------------------------------------------
 static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornername, color_t color)
 {
@@ -331,10 +389,13 @@ static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornerna
 	int16_t ddF_y = -2 * r;
 	int16_t x = 0;
 	int16_t y = r;
+	int16_t xs = 1;
 
-	disp_select();
+	if (disp_select() != ESP_OK) return;
 	while (x < y) {
 		if (f >= 0) {
+			_circleSpans(x0, y0, xs, x, y, cornername, color);
+			xs = x + 1;
 			y--;
 			ddF_y += 2;
 			f += ddF_y;
@@ -342,23 +403,8 @@ static void drawCircleHelper(int16_t x0, int16_t y0, int16_t r, uint8_t cornerna
 		x++;
 		ddF_x += 2;
 		f += ddF_x;
-		if (cornername & 0x4) {
-			_drawPixel(x0 + x, y0 + y, color, 0);
-			_drawPixel(x0 + y, y0 + x, color, 0);
-		}
-		if (cornername & 0x2) {
-			_drawPixel(x0 + x, y0 - y, color, 0);
-			_drawPixel(x0 + y, y0 - x, color, 0);
-		}
-		if (cornername & 0x8) {
-			_drawPixel(x0 - y, y0 + x, color, 0);
-			_drawPixel(x0 - x, y0 + y, color, 0);
-		}
-		if (cornername & 0x1) {
-			_drawPixel(x0 - y, y0 - x, color, 0);
-			_drawPixel(x0 - x, y0 - y, color, 0);
-		}
 	}
+	_circleSpans(x0, y0, xs, x, y, cornername, color);
 	disp_deselect();
 }
 
@@ -513,6 +559,8 @@ static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, ui
     return;
   }
 
+  if (disp_select() != ESP_OK) return;
+
   int16_t
     dx01 = x1 - x0,
     dy01 = y1 - y0,
@@ -543,7 +591,7 @@ static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, ui
     b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
     */
     if(a > b) swap(a,b);
-    _drawFastHLine(a, y, b-a+1, color);
+    _spanH(a, b, y, color);
   }
 
   // For lower part of triangle, find scanline crossings for segments
@@ -560,8 +608,9 @@ static void _fillTriangle(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, ui
     b = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
     */
     if(a > b) swap(a,b);
-    _drawFastHLine(a, y, b-a+1, color);
+    _spanH(a, b, y, color);
   }
+  disp_deselect();
 }
 
 //================================================================================================================
@@ -583,14 +632,20 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
 	int ddF_y = -2 * radius;
 	int x1 = 0;
 	int y1 = radius;
+	int xs = 0;
 
-	disp_select();
-	_drawPixel(x, y + radius, color, 0);
-	_drawPixel(x, y - radius, color, 0);
-	_drawPixel(x + radius, y, color, 0);
-	_drawPixel(x - radius, y, color, 0);
+	if (disp_select() != ESP_OK) return;
 	while(x1 < y1) {
 		if (f >= 0) {
+			if (xs == 0) {
+				// First run crosses the axes, one span on each side
+				_spanH(x - x1, x + x1, y + y1, color);
+				_spanH(x - x1, x + x1, y - y1, color);
+				_spanV(x + y1, y - x1, y + x1, color);
+				_spanV(x - y1, y - x1, y + x1, color);
+			}
+			else _circleSpans(x, y, xs, x1, y1, 0xF, color);
+			xs = x1 + 1;
 			y1--;
 			ddF_y += 2;
 			f += ddF_y;
@@ -598,16 +653,15 @@ void TFT_drawCircle(int16_t x, int16_t y, int radius, color_t color) {
 		x1++;
 		ddF_x += 2;
 		f += ddF_x;
-		_drawPixel(x + x1, y + y1, color, 0);
-		_drawPixel(x - x1, y + y1, color, 0);
-		_drawPixel(x + x1, y - y1, color, 0);
-		_drawPixel(x - x1, y - y1, color, 0);
-		_drawPixel(x + y1, y + x1, color, 0);
-		_drawPixel(x - y1, y + x1, color, 0);
-		_drawPixel(x + y1, y - x1, color, 0);
-		_drawPixel(x - y1, y - x1, color, 0);
 	}
-  disp_deselect();
+	if (xs == 0) {
+		_spanH(x - x1, x + x1, y + y1, color);
+		_spanH(x - x1, x + x1, y - y1, color);
+		_spanV(x + y1, y - x1, y + x1, color);
+		_spanV(x - y1, y - x1, y + x1, color);
+	}
+	else _circleSpans(x, y, xs, x1, y1, 0xF, color);
+	disp_deselect();
 }
 
 //====================================================================
@@ -837,31 +891,46 @@ static void _fillArcOffsetted(uint16_t cx, uint16_t cy, uint16_t radius, uint16_
 	int ir2 = (radius - thickness) * (radius - thickness);
 	int or2 = radius * radius;
 
-	disp_select();
-	for (int x = -radius; x <= radius; x++) {
-		for (int y = -radius; y <= radius; y++) {
+	if (disp_select() != ESP_OK) return;
+	// Scan rows, each run of pixels inside the arc is drawn as one span
+	for (int y = -radius; y <= radius; y++) {
+		int y2 = y * y;
+		float ys = y * sslope;
+		float ye = y * eslope;
+		int xs = 0;
+		uint8_t run = 0;
+
+		for (int x = -radius; x <= radius; x++) {
 			int x2 = x * x;
-			int y2 = y * y;
 
 			if (
 				(x2 + y2 < or2 && x2 + y2 >= ir2) &&
 				(
-				(y > 0 && start < 180 && x <= y * sslope) ||
-				(y < 0 && start > 180 && x >= y * sslope) ||
+				(y > 0 && start < 180 && x <= ys) ||
+				(y < 0 && start > 180 && x >= ys) ||
 				(y < 0 && start <= 180) ||
 				(y == 0 && start <= 180 && x < 0) ||
 				(y == 0 && start == 0 && x > 0)
 				) &&
 				(
-				(y > 0 && end < 180 && x >= y * eslope) ||
-				(y < 0 && end > 180 && x <= y * eslope) ||
+				(y > 0 && end < 180 && x >= ye) ||
+				(y < 0 && end > 180 && x <= ye) ||
 				(y > 0 && end >= 180) ||
 				(y == 0 && end >= 180 && x < 0) ||
 				(y == 0 && start == 0 && x > 0)
 				)
-				)
-				_drawPixel(cx+x, cy+y, color, 0);
+				) {
+				if (!run) {
+					xs = x;
+					run = 1;
+				}
+			}
+			else if (run) {
+				_spanH(cx+xs, cx+x-1, cy+y, color);
+				run = 0;
+			}
 		}
+		if (run) _spanH(cx+xs, cx+radius, cy+y, color);
 	}
 	disp_deselect();
 }
@@ -1020,6 +1089,8 @@ static int load_file_font(const char *fontfile, int info)
 	if (userfont != NULL) {
 		free(userfont);
 		userfont = NULL;
+		font_index_font = NULL;
+		TFT_clearGlyphCache();		// glyphs of the freed font
 	}
 
     struct stat sb;
@@ -1374,18 +1445,30 @@ void getFontCharacters(uint8_t *buf)
 }
 
 // Set max width & height of the proportional font
+// and index its characters for getCharPtr()
 //-----------------------------
 static void getMaxWidthHeight()
 {
 	uint16_t tempPtr = 4; // point at first char data
 	uint8_t cc, cw, ch, cd, cy;
 
+	if (font_index_font == tft_cfont.font) {
+		// already measured and indexed
+		tft_cfont.numchars = font_index_cfont.numchars;
+		tft_cfont.max_x_size = font_index_cfont.max_x_size;
+		tft_cfont.y_size = font_index_cfont.y_size;
+		tft_cfont.size = font_index_cfont.size;
+		return;
+	}
+
 	tft_cfont.numchars = 0;
 	tft_cfont.max_x_size = 0;
+	memset(font_index, 0, sizeof(font_index));
 
     cc = tft_cfont.font[tempPtr++];
     while (cc != 0xFF)  {
     	tft_cfont.numchars++;
+		if (font_index[cc] == 0) font_index[cc] = tempPtr;	// first one is used
         cy = tft_cfont.font[tempPtr++];
         cw = tft_cfont.font[tempPtr++];
         ch = tft_cfont.font[tempPtr++];
@@ -1403,41 +1486,35 @@ static void getMaxWidthHeight()
 	    cc = tft_cfont.font[tempPtr++];
 	}
     tft_cfont.size = tempPtr;
+
+	font_index_font = tft_cfont.font;
+	font_index_cfont = tft_cfont;
 }
 
 // Return the Glyph data for an individual character in the proportional font
 //------------------------------------
 static uint8_t getCharPtr(uint8_t c) {
-  uint16_t tempPtr = 4; // point at first char data
+  uint16_t tempPtr = font_index[c]; // point at char data, after the char code
 
-  do {
-	fontChar.charCode = tft_cfont.font[tempPtr++];
-    if (fontChar.charCode == 0xFF) return 0;
-
-    fontChar.adjYOffset = tft_cfont.font[tempPtr++];
-    fontChar.width = tft_cfont.font[tempPtr++];
-    fontChar.height = tft_cfont.font[tempPtr++];
-    fontChar.xOffset = tft_cfont.font[tempPtr++];
-    fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
-    fontChar.xDelta = tft_cfont.font[tempPtr++];
-
-    if (c != fontChar.charCode && fontChar.charCode != 0xFF) {
-      if (fontChar.width != 0) {
-        // packed bits
-        tempPtr += (((fontChar.width * fontChar.height)-1) / 8) + 1;
-      }
-    }
-  } while ((c != fontChar.charCode) && (fontChar.charCode != 0xFF));
+  if (tempPtr == 0) {
+    fontChar.charCode = 0xFF;
+    return 0;
+  }
 
+  fontChar.charCode = c;
+  fontChar.adjYOffset = tft_cfont.font[tempPtr++];
+  fontChar.width = tft_cfont.font[tempPtr++];
+  fontChar.height = tft_cfont.font[tempPtr++];
+  fontChar.xOffset = tft_cfont.font[tempPtr++];
+  fontChar.xOffset = fontChar.xOffset < 0x80 ? fontChar.xOffset : -(0xFF - fontChar.xOffset);
+  fontChar.xDelta = tft_cfont.font[tempPtr++];
   fontChar.dataPtr = tempPtr;
-  if (c == fontChar.charCode) {
-    if (tft_font_forceFixed > 0) {
-      // fix width & offset for forced fixed width
-      fontChar.xDelta = tft_cfont.max_x_size;
-      fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
-    }
+
+  if (tft_font_forceFixed > 0) {
+    // fix width & offset for forced fixed width
+    fontChar.xDelta = tft_cfont.max_x_size;
+    fontChar.xOffset = (fontChar.xDelta - fontChar.width) / 2;
   }
-  else return 0;
 
   return 1;
 }
@@ -1536,6 +1613,145 @@ void TFT_setFont(uint8_t font, const char *font_file)
 // Character visible pixels rectangle is (xOffset, yOffset) (xOffset+Width-1, yOffset+Height-1)
 //---------------------------------------------------------------------------------------------
 
+#if CONFIG_TFT_GLYPH_CACHE_SIZE > 0
+// ==== Cache of expanded glyphs ==============================================
+// Glyphs of proportional fonts are kept expanded to pixels in DMA capable
+// memory, for the font, character and colors they were drawn with. The least
+// recently used are dropped to stay within CONFIG_TFT_GLYPH_CACHE_SIZE bytes.
+
+#define GLYPH_CACHE_ENTRIES 64
+
+typedef struct {
+	const uint8_t *font;
+	uint8_t charCode;
+	uint8_t forceFixed;			// glyphs are centered when forced to fixed width
+	tft_pixel_t fg;
+	tft_pixel_t bg;
+	uint32_t used;				// LRU stamp, 0 if the entry is free
+	uint32_t len;				// pixels
+	tft_pixel_t *pixels;
+} glyph_cache_t;
+
+static glyph_cache_t glyph_cache[GLYPH_CACHE_ENTRIES];
+static uint32_t glyph_cache_bytes = 0;
+static uint32_t glyph_cache_stamp = 0;
+
+//---------------------------------------------------
+static void glyph_cache_drop(glyph_cache_t *glyph) {
+	glyph_cache_bytes -= glyph->len * sizeof(tft_pixel_t);
+	free(glyph->pixels);
+	memset(glyph, 0, sizeof(glyph_cache_t));
+}
+
+// Find glyph of the current font and character 'code' in colors 'fg', 'bg'
+//-------------------------------------------------------------------------------------
+static glyph_cache_t *glyph_cache_find(uint8_t code, tft_pixel_t *fg, tft_pixel_t *bg) {
+	for (int i = 0; i < GLYPH_CACHE_ENTRIES; i++) {
+		glyph_cache_t *glyph = &glyph_cache[i];
+		if ((glyph->used) && (glyph->charCode == code) && (glyph->font == tft_cfont.font) && (glyph->forceFixed == tft_font_forceFixed) &&
+			(memcmp(&glyph->fg, fg, sizeof(tft_pixel_t)) == 0) && (memcmp(&glyph->bg, bg, sizeof(tft_pixel_t)) == 0)) {
+			glyph->used = ++glyph_cache_stamp;
+			return glyph;
+		}
+	}
+	return NULL;
+}
+
+// Allocate an entry for 'len' pixels, dropping the least recently used glyphs
+// to make room. Returns the pixel buffer, NULL if the glyph is not cached
+//-------------------------------------------------------------------------------------------
+static tft_pixel_t *glyph_cache_add(uint8_t code, tft_pixel_t *fg, tft_pixel_t *bg, uint32_t len) {
+	uint32_t bytes = len * sizeof(tft_pixel_t);
+	glyph_cache_t *slot = NULL;
+
+	if (bytes > CONFIG_TFT_GLYPH_CACHE_SIZE) return NULL;
+
+	while (1) {
+		glyph_cache_t *lru = NULL;
+		slot = NULL;
+		for (int i = 0; i < GLYPH_CACHE_ENTRIES; i++) {
+			glyph_cache_t *glyph = &glyph_cache[i];
+			if (glyph->used == 0) {
+				if (slot == NULL) slot = glyph;
+			}
+			else if ((lru == NULL) || (glyph->used < lru->used)) lru = glyph;
+		}
+		if ((slot) && ((glyph_cache_bytes + bytes) <= CONFIG_TFT_GLYPH_CACHE_SIZE)) break;
+		if (lru == NULL) return NULL;
+		glyph_cache_drop(lru);
+	}
+
+	slot->pixels = heap_caps_malloc(bytes, MALLOC_CAP_DMA);
+	if (slot->pixels == NULL) return NULL;
+
+	slot->font = tft_cfont.font;
+	slot->charCode = code;
+	slot->forceFixed = tft_font_forceFixed;
+	slot->fg = *fg;
+	slot->bg = *bg;
+	slot->len = len;
+	slot->used = ++glyph_cache_stamp;
+	glyph_cache_bytes += bytes;
+	return slot->pixels;
+}
+#endif
+
+//=============================
+void TFT_clearGlyphCache() {
+#if CONFIG_TFT_GLYPH_CACHE_SIZE > 0
+	for (int i = 0; i < GLYPH_CACHE_ENTRIES; i++) {
+		if (glyph_cache[i].used) glyph_cache_drop(&glyph_cache[i]);
+	}
+#endif
+}
+
+// Set the visible pixels of the proportional character in fontChar to 'fg'
+// in 'buf', a glyph 'width' pixels wide in lines of 'stride' pixels
+//---------------------------------------------------------------------------------
+static void expandPropChar(tft_pixel_t *buf, int stride, int width, tft_pixel_t fg) {
+	uint8_t ch = 0;
+	uint8_t mask = 0x80;
+	uint16_t dataPtr = fontChar.dataPtr;
+
+	for (int j=0; j < fontChar.height; j++) {
+		int by = j + fontChar.adjYOffset;
+		for (int i=0; i < fontChar.width; i++) {
+			if (((i + (j*fontChar.width)) % 8) == 0) {
+				mask = 0x80;
+				ch = tft_cfont.font[dataPtr++];
+			}
+			int bx = fontChar.xOffset + i;
+			if (((ch & mask) != 0) && (bx >= 0) && (bx < width) && (by >= 0) && (by < tft_cfont.y_size)) {
+				// visible pixel
+				buf[(by * stride) + bx] = fg;
+			}
+			mask >>= 1;
+		}
+	}
+}
+
+// Return the expanded proportional character in fontChar from the glyph cache,
+// expanding it first if it is not there. NULL if it cannot be cached
+//----------------------------------------------------------------------------------
+static tft_pixel_t *getPropGlyph(int char_width, tft_pixel_t *fg, tft_pixel_t *bg) {
+#if CONFIG_TFT_GLYPH_CACHE_SIZE > 0
+	glyph_cache_t *glyph = glyph_cache_find(fontChar.charCode, fg, bg);
+	if (glyph) return glyph->pixels;
+
+	int len = char_width * tft_cfont.y_size;
+	tft_pixel_t *pixels = glyph_cache_add(fontChar.charCode, fg, bg, len);
+	if (pixels) {
+		for (int n = 0; n < len; n++) {
+			pixels[n] = *bg;
+		}
+		expandPropChar(pixels, char_width, char_width, *fg);
+	}
+	return pixels;
+#else
+	return NULL;
+#endif
+}
+
 // print non-rotated proportional character
 // character is already in fontChar
 //----------------------------------------------
@@ -1546,48 +1762,32 @@ static int printProportionalChar(int x, int y) {
 	char_width = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
 
 	if ((tft_font_buffered_char) && (!tft_font_transparent)) {
-		int len, bufPos;
+		int len;
 
 		// === buffer Glyph data for faster sending ===
 		len = char_width * tft_cfont.y_size;
-		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
-		if (color_line) {
-			// fill with background color
-			for (int n = 0; n < len; n++) {
-				color_line[n] = tft_bg;
-			}
-			// set character pixels to foreground color
-			uint8_t mask = 0x80;
-			for (j=0; j < fontChar.height; j++) {
-				for (i=0; i < fontChar.width; i++) {
-					if (((i + (j*fontChar.width)) % 8) == 0) {
-						mask = 0x80;
-						ch = tft_cfont.font[fontChar.dataPtr++];
-					}
-					if ((ch & mask) != 0) {
-						// visible pixel
-						bufPos = ((j + fontChar.adjYOffset) * char_width) + (fontChar.xOffset + i);  // bufY + bufX
-						color_line[bufPos] = tft_fg;
-						/*
-						bufY = (j + fontChar.adjYOffset) * char_width;
-						bufX = fontChar.xOffset + i;
-						if ((bufX < 0) || (bufX > char_width)) {
-							printf("[%c] X ERR: %d\r\n", fontChar.charCode, bufX);
-						}
-						bufPos = bufY + bufX;
-						if ((bufPos < len) && (bufPos > 0)) color_line[bufPos] = tft_fg;
-						else printf("[%c] ERR: %d > %d  W=%d  H=%d  bufX=%d  bufY=%d  X=%d  Y=%d\r\n",
-								fontChar.charCode, bufPos, len, char_width, tft_cfont.y_size, bufX, bufY, fontChar.xOffset + i, j + fontChar.adjYOffset);
-						*/
-					}
-					mask >>= 1;
+		tft_pixel_t fg = TFT_pixel(tft_fg);
+		tft_pixel_t bg = TFT_pixel(tft_bg);
+		tft_pixel_t *color_line = getPropGlyph(char_width, &fg, &bg);
+		uint8_t cached = (color_line != NULL);
+
+		if (color_line == NULL) {
+			color_line = TFT_dma_lease(len*sizeof(tft_pixel_t));
+			if (color_line) {
+				// fill with background color
+				for (int n = 0; n < len; n++) {
+					color_line[n] = bg;
 				}
+				// set character pixels to foreground color
+				expandPropChar(color_line, char_width, char_width, fg);
 			}
+		}
+		if (color_line) {
 			// send to display in one transaction
 			disp_select();
-			send_data(x, y, x+char_width-1, y+tft_cfont.y_size-1, len, color_line);
+			send_pixels(x, y, x+char_width-1, y+tft_cfont.y_size-1, len, color_line);
 			disp_deselect();
-			free(color_line);
+			if (!cached) TFT_dma_release(color_line);
 
 			return char_width;
 		}
@@ -1636,11 +1836,13 @@ static void printChar(uint8_t c, int x, int y) {
 	if ((tft_font_buffered_char) && (!tft_font_transparent)) {
 		// === buffer Glyph data for faster sending ===
 		len = tft_cfont.x_size * tft_cfont.y_size;
-		color_t *color_line = heap_caps_malloc(len*3, MALLOC_CAP_DMA);
+		tft_pixel_t *color_line = TFT_dma_lease(len*sizeof(tft_pixel_t));
 		if (color_line) {
+			tft_pixel_t fg = TFT_pixel(tft_fg);
+			tft_pixel_t bg = TFT_pixel(tft_bg);
 			// fill with background color
 			for (int n = 0; n < len; n++) {
-				color_line[n] = tft_bg;
+				color_line[n] = bg;
 			}
 			// set character pixels to foreground color
 			for (j=0; j<tft_cfont.y_size; j++) {
@@ -1648,7 +1850,7 @@ static void printChar(uint8_t c, int x, int y) {
 					ch = tft_cfont.font[temp+k];
 					mask=0x80;
 					for (i=0; i<8; i++) {
-						if ((ch & mask) !=0) color_line[(j*tft_cfont.x_size) + (i+(k*8))] = tft_fg;
+						if ((ch & mask) !=0) color_line[(j*tft_cfont.x_size) + (i+(k*8))] = fg;
 						mask >>= 1;
 					}
 				}
@@ -1656,9 +1858,9 @@ static void printChar(uint8_t c, int x, int y) {
 			}
 			// send to display in one transaction
 			disp_select();
-			send_data(x, y, x+tft_cfont.x_size-1, y+tft_cfont.y_size-1, len, color_line);
+			send_pixels(x, y, x+tft_cfont.x_size-1, y+tft_cfont.y_size-1, len, color_line);
 			disp_deselect();
-			free(color_line);
+			TFT_dma_release(color_line);
 
 			return;
 		}
@@ -1919,6 +2121,103 @@ static void _draw7seg(int16_t x, int16_t y, int8_t num, int16_t w, int16_t l, co
 }
 //==============================================================================
 
+// Print 'stl' characters of 'st' at tft_x, tft_y as one run: the whole line is
+// composed in one buffer at the font height and sent in a single transaction.
+// Only non-rotated, non-transparent bitmap fonts on a single line are printed,
+// returns 0 if the string must be printed character by character
+//-----------------------------------------------
+static int printTextRun(const char *st, int stl) {
+	int i, w, end, cw;
+	int h = tft_cfont.y_size;
+	uint8_t ch;
+
+	if ((tft_font_rotate != 0) || (tft_font_transparent) || (!tft_font_buffered_char) || (tft_cfont.bitmap != 1)) return 0;
+
+	// ** Measure the run, it ends at the first character which does not fit, as in TFT_print()
+	int n = 0;
+	w = 0;
+	end = 0;
+	for (i=0; i<stl; i++) {
+		ch = st[i];
+		if ((ch == 0x0D) || (ch == 0x0A)) return 0;
+
+		if (tft_cfont.x_size == 0) {
+			if (!getCharPtr(ch)) continue;
+			if ((tft_x + w + fontChar.xDelta) > tft_dispWin.x2) break;
+			cw = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
+			if ((w + cw) > end) end = w + cw;
+			w += cw + 1;
+		}
+		else {
+			if ((tft_x + w + tft_cfont.x_size) > tft_dispWin.x2) break;
+			w += tft_cfont.x_size;
+			end = w;
+		}
+	}
+	if ((i < stl) && (tft_text_wrap)) return 0;
+	n = i;
+
+	if (end == 0) return 1;	// nothing printable
+	if ((tft_x + end - 1) > tft_dispWin.x2) end = tft_dispWin.x2 - tft_x + 1;
+
+	uint32_t len = end * h;
+	tft_pixel_t *line = TFT_dma_lease(len*sizeof(tft_pixel_t));
+	if (line == NULL) return 0;
+
+	tft_pixel_t fg = TFT_pixel(tft_fg);
+	tft_pixel_t bg = TFT_pixel(tft_bg);
+	for (int p = 0; p < len; p++) {
+		line[p] = bg;
+	}
+
+	// ** Compose the characters
+	int cx = 0;
+	for (i=0; i<n; i++) {
+		ch = st[i];
+		if (tft_cfont.x_size == 0) {
+			if (!getCharPtr(ch)) continue;
+			cw = ((fontChar.width > fontChar.xDelta) ? fontChar.width : fontChar.xDelta);
+			int vis = ((cx + cw) > end) ? (end - cx) : cw;	// visible columns
+			if (vis > 0) {
+				tft_pixel_t *glyph = getPropGlyph(cw, &fg, &bg);
+				if (glyph) {
+					for (int r = 0; r < h; r++) {
+						memcpy(line + (r * end) + cx, glyph + (r * cw), vis * sizeof(tft_pixel_t));
+					}
+				}
+				else expandPropChar(line + cx, end, vis, fg);
+			}
+			cx += cw + 1;
+		}
+		else {
+			// fixed width font
+			if ((ch < tft_cfont.offset) || ((ch-tft_cfont.offset) > tft_cfont.numchars)) ch = tft_cfont.offset;
+			int fz = (tft_cfont.x_size + 7) / 8;	// bytes per char row
+			int temp = ((ch-tft_cfont.offset)*(fz*h))+4;
+			for (int j=0; j<h; j++) {
+				for (int k=0; k<fz; k++) {
+					uint8_t bits = tft_cfont.font[temp+k];
+					for (int b=0; b<8; b++) {
+						int bx = cx + b + (k*8);
+						if ((bits & (0x80 >> b)) && (bx < (cx + tft_cfont.x_size)) && (bx < end)) line[(j * end) + bx] = fg;
+					}
+				}
+				temp += fz;
+			}
+			cx += tft_cfont.x_size;
+		}
+	}
+
+	// ** Send the whole run in one transaction
+	disp_select();
+	send_pixels(tft_x, tft_y, tft_x+end-1, tft_y+h-1, len, line);
+	disp_deselect();
+	TFT_dma_release(line);
+
+	tft_x += w;
+	return 1;
+}
+
 //============================================
 void TFT_print(const char *st, int x, int y) {
 	int stl, i, tmpw, tmph, fh;
@@ -1975,6 +2274,9 @@ void TFT_print(const char *st, int x, int y) {
 
 	if ((tft_y + tmph - 1) > tft_dispWin.y2) return;
 
+	// ** Whole line in one transaction if possible
+	if (printTextRun(st, stl)) return;
+
 	int offset = TFT_OFFSET;
 
 	for (i=0; i<stl; i++) {
@@ -2432,12 +2734,12 @@ void TFT_jpg_image(int x, int y, uint8_t scale, const char *fname, uint8_t *buf,
 			dev.x = x;
 			dev.y = y;
 
-			dev.linbuf[0] = heap_caps_malloc(JPG_IMAGE_LINE_BUF_SIZE*3, MALLOC_CAP_DMA);
+			dev.linbuf[0] = TFT_dma_lease(JPG_IMAGE_LINE_BUF_SIZE*3);
 			if (dev.linbuf[0] == NULL) {
 				if (tft_image_debug) printf("Error allocating line buffer #0\r\n");
 				goto exit;
 			}
-			dev.linbuf[1] = heap_caps_malloc(JPG_IMAGE_LINE_BUF_SIZE*3, MALLOC_CAP_DMA);
+			dev.linbuf[1] = TFT_dma_lease(JPG_IMAGE_LINE_BUF_SIZE*3);
 			if (dev.linbuf[1] == NULL) {
 				if (tft_image_debug) printf("Error allocating line buffer #1\r\n");
 				goto exit;
@@ -2463,8 +2765,8 @@ void TFT_jpg_image(int x, int y, uint8_t scale, const char *fname, uint8_t *buf,
 
 exit:
 	if (work) free(work);  // free work buffer
-	if (dev.linbuf[0]) free(dev.linbuf[0]);
-	if (dev.linbuf[1]) free(dev.linbuf[1]);
+	TFT_dma_release(dev.linbuf[0]);
+	TFT_dma_release(dev.linbuf[1]);
     if (dev.fhndl) fclose(dev.fhndl);  // close input file
 }
 
@@ -2600,14 +2902,14 @@ int TFT_bmp_image(int x, int y, uint8_t scale, const char *fname, uint8_t *imgbu
 	}
 
 	// ** Allocate memory for 2 lines of image pixels
-	line_buf[0] = heap_caps_malloc(img_xsize*3, MALLOC_CAP_DMA);
+	line_buf[0] = TFT_dma_lease(img_xsize*3);
 	if (line_buf[0] == NULL) {
 	    sprintf(err_buf, "allocating line buffer #1");
 		err=-12;
 		goto exit;
 	}
 
-	line_buf[1] = heap_caps_malloc(img_xsize*3, MALLOC_CAP_DMA);
+	line_buf[1] = TFT_dma_lease(img_xsize*3);
 	if (line_buf[1] == NULL) {
 	    sprintf(err_buf, "allocating line buffer #2");
 		err=-13;
@@ -2740,8 +3042,8 @@ exit1:
 	disp_deselect();
 exit:
 	if (scale_buf) free(scale_buf);
-	if (line_buf[0]) free(line_buf[0]);
-	if (line_buf[1]) free(line_buf[1]);
+	TFT_dma_release(line_buf[0]);
+	TFT_dma_release(line_buf[1]);
 	if (fhndl) fclose(fhndl);
 	if ((err) && (tft_image_debug)) printf("Error: %d [%s]\r\n", err, err_buf);
 
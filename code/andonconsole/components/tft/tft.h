@@ -439,6 +439,15 @@ void TFT_drawPolygon(int cx, int cy, int sides, int diameter, color_t color, col
 //----------------------------------------------------
 void TFT_setFont(uint8_t font, const char *font_file);
 
+/*
+ * Drop all glyphs kept by the glyph cache (CONFIG_TFT_GLYPH_CACHE_SIZE)
+ * Glyphs of proportional fonts are cached expanded to pixels, per font, character and colors,
+ * so repeated text is sent without unpacking the font data again
+ * Called when a font loaded from file is freed
+ */
+//=========================
+void TFT_clearGlyphCache();
+
 /*
  * Returns current font height & width in pixels.
  *
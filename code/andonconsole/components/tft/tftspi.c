@@ -8,12 +8,15 @@
  *
 */
 
+#include <stdio.h>
 #include <string.h>
 #include "tftspi.h"
 #include "freertos/task.h"
 #include "soc/spi_reg.h"
 #include "driver/gpio.h"
 #include "rom/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
 
 
 // ====================================================
@@ -35,11 +38,76 @@ uint8_t tft_disp_type = DEFAULT_DISP_TYPE;
 spi_lobo_device_handle_t tft_disp_spi = NULL;
 spi_lobo_device_handle_t tft_ts_spi = NULL;
 
+// Bytes of pixel data sent to the display, for benchmarks
+uint32_t tft_pixel_bytes = 0;
+
+// DMA buffers leased from the heap because the pool had no room for them
+uint32_t tft_dma_pool_misses = 0;
+
 // ====================================================
 
 
-static color_t *trans_cline = NULL;
+// Pool of DMA capable memory, allocated once by TFT_dma_pool_init()
+// and leased in blocks by the drawing code
+#define TFT_DMA_POOL_BLOCK	512
+#define TFT_DMA_POOL_BLOCKS	(CONFIG_TFT_DMA_POOL_SIZE / TFT_DMA_POOL_BLOCK)
+
+static uint8_t *dma_pool = NULL;
+static uint8_t dma_pool_run[TFT_DMA_POOL_BLOCKS];	// Blocks leased from each block on, 0 if free
+static portMUX_TYPE dma_pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Ping-pong pair of DMA buffers from the pool, the next chunk of pixels
+// is prepared in one of them while the other one is sent
+#define TFT_DMA_BUF_BYTES	3072		// Whole pixels in both 16 and 18-bit color
+#define TFT_DMA_BUF_PIXELS	(TFT_DMA_BUF_BYTES / sizeof(tft_pixel_t))
+// DMA transfers shorter than this are waited for by polling the bus
+#define TFT_DMA_WAIT_INTR_BYTES	512
+
+_Static_assert(CONFIG_TFT_DMA_POOL_SIZE >= (2 * TFT_DMA_BUF_BYTES), "CONFIG_TFT_DMA_POOL_SIZE smaller than the ping-pong buffers");
+
+static tft_pixel_t *dma_buf[2] = {NULL, NULL};
+static uint32_t dma_fill_len = 0;		// Pixels of dma_buf[0] holding dma_fill_pixel
+static tft_pixel_t dma_fill_pixel;
 static uint8_t _dma_sending = 0;
+static uint32_t _dma_bytes = 0;			// Size of the DMA transfer in progress
+
+// DMA descriptors prepared for a buffer and size are kept and reused by the
+// next sends of the same buffer and size, like the ping-pong buffers and the
+// fill buffer. Only buffers fitting one descriptor are kept.
+// With CONFIG_TFT_DMA_LOOPED_FILL a looped descriptor points back to itself,
+// the transfer length ends the DMA run, so a repeated fill of any length needs
+// only one descriptor (see _dma_chain() for what that relies on).
+#define TFT_DMA_CHAINS		4
+#if CONFIG_TFT_DMA_LOOPED_FILL
+// Longest repeated fill sent as one DMA run; devices with higher priority
+// wait for the bus no longer than this (whole pixels in both 16 and 18-bit color)
+#define TFT_DMA_RUN_BYTES	(5 * TFT_DMA_BUF_BYTES)
+#endif
+
+typedef struct {
+	const uint8_t *data;
+	uint32_t size;
+	uint8_t loop;
+} dma_chain_t;
+
+static dma_chain_t dma_chain[TFT_DMA_CHAINS];
+DMA_ATTR static lldesc_t dma_chain_desc[TFT_DMA_CHAINS];
+static int dma_chain_next = 0;			// Slot replaced by the next chain prepared
+
+// Write combining of single pixels: drawPixel() collects pixels continuing
+// a row or a column into a run, sent as one window when the next pixel does
+// not continue it, before any other display transfer and on disp_deselect().
+// A run fits the SPI data registers (512 bits), so it never needs DMA.
+#define TFT_PX_RUN_MAX	(512 / (8 * sizeof(tft_pixel_t)))
+#define TFT_PX_RUN_H	1
+#define TFT_PX_RUN_V	2
+
+static color_t px_run[TFT_PX_RUN_MAX];
+static uint32_t px_run_len = 0;
+static int16_t px_run_x, px_run_y;		// First pixel of the run
+static uint8_t px_run_dir = 0;			// TFT_PX_RUN_H or TFT_PX_RUN_V, 0 while one pixel long
+
+static void _px_flush();
 
 // RGB to GRAYSCALE constants
 // 0.2989  0.5870  0.1140
@@ -47,19 +115,36 @@ static uint8_t _dma_sending = 0;
 #define GS_FACT_G 0.4870
 #define GS_FACT_B 0.2140
 
+#ifndef DISP_COLOR_BITS_16
+#define DISP_COLOR_BITS_16 0x55
+#endif
+
+#if CONFIG_TFT_FRAMEBUFFER
+// RAM framebuffer, RGB565 as sent in 16-bit mode, one word per pixel in display coordinates
+// (without the static offsets). For every row the span of columns
+// changed since the last TFT_flush() is kept.
+static uint16_t *tft_fb = NULL;
+static int16_t *fb_dirty_x1 = NULL;		// First changed column of each row, -1 if none
+static int16_t *fb_dirty_x2 = NULL;		// Last changed column of each row
+
+#endif
+
 
 
 // ==== Functions =====================
 
+// Wait for the transfer in progress to finish. A long DMA transfer is waited
+// for on the SPI transfer done interrupt, so other tasks can run meanwhile.
+// 'free_line' is not used, the DMA buffers are kept
 //------------------------------------------------------
 esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
 {
+	esp_err_t ret = ESP_OK;
+
 	// Wait for SPI bus ready
-	while (tft_disp_spi->host->hw->cmd.usr);
-	if ((free_line) && (trans_cline)) {
-		free(trans_cline);
-		trans_cline = NULL;
-	}
+	if (((_dma_sending) && (_dma_bytes >= TFT_DMA_WAIT_INTR_BYTES)) || (tft_disp_spi->host->queue_active)) ret = spi_lobo_wait_trans_done(tft_disp_spi);
+	else while (tft_disp_spi->host->hw->cmd.usr);
+
 	if (_dma_sending) {
 	    //Tell common code DMA workaround that our DMA channel is idle. If needed, the code will do a DMA reset.
 	    if (tft_disp_spi->host->dma_chan) spi_lobo_dmaworkaround_idle(tft_disp_spi->host->dma_chan);
@@ -72,7 +157,97 @@ esp_err_t IRAM_ATTR wait_trans_finish(uint8_t free_line)
 		tft_disp_spi->host->hw->dma_conf.out_data_burst_en=1;
 		_dma_sending = 0;
 	}
-    return ESP_OK;
+    return ret;
+}
+
+// Transfers aborted because the display lost the SPI bus while yielding it.
+// Reported from the error path only, at most once every TFT_BUS_LOST_LOG_MS.
+#define TFT_BUS_LOST_LOG_MS	5000
+
+static const char *TAG_TFT = "TFT";
+static uint32_t bus_lost_count = 0;
+static uint32_t bus_lost_logged = 0;		// esp_log_timestamp() of the last report
+
+//-------------------------------------------------------------
+static esp_err_t _disp_bus_lost(esp_err_t err, const char *what)
+{
+	bus_lost_count++;
+	uint32_t now = esp_log_timestamp();
+	if ((bus_lost_count == 1) || ((now - bus_lost_logged) >= TFT_BUS_LOST_LOG_MS)) {
+		ESP_LOGW(TAG_TFT, "Display lost the SPI bus, %s aborted (%s), %u aborted since boot",
+				what, esp_err_to_name(err), (unsigned)bus_lost_count);
+		bus_lost_logged = now;
+	}
+	return err;
+}
+
+// ==== DMA buffer pool ===============================
+
+//================================
+esp_err_t TFT_dma_pool_init()
+{
+	if (dma_pool) return ESP_OK;
+
+	dma_pool = heap_caps_malloc(TFT_DMA_POOL_BLOCKS * TFT_DMA_POOL_BLOCK, MALLOC_CAP_DMA);
+	if (dma_pool == NULL) {
+		printf("TFT: no memory for the %d byte DMA buffer pool, sending without DMA\r\n", TFT_DMA_POOL_BLOCKS * TFT_DMA_POOL_BLOCK);
+		return ESP_ERR_NO_MEM;
+	}
+	memset(dma_pool_run, 0, sizeof(dma_pool_run));
+
+	// Kept for good
+	dma_buf[0] = TFT_dma_lease(TFT_DMA_BUF_BYTES);
+	dma_buf[1] = TFT_dma_lease(TFT_DMA_BUF_BYTES);
+	return ESP_OK;
+}
+
+// First fit of consecutive free blocks
+//=================================
+void *TFT_dma_lease(uint32_t bytes)
+{
+	int need = (bytes + TFT_DMA_POOL_BLOCK - 1) / TFT_DMA_POOL_BLOCK;
+	int start = -1;
+
+	if ((dma_pool) && (need > 0) && (need <= TFT_DMA_POOL_BLOCKS)) {
+		portENTER_CRITICAL(&dma_pool_mux);
+		int i = 0;
+		while (i <= (TFT_DMA_POOL_BLOCKS - need)) {
+			int n = 0;
+			while ((n < need) && (dma_pool_run[i+n] == 0)) n++;
+			if (n == need) {
+				start = i;
+				dma_pool_run[i] = need;
+				for (n = 1; n < need; n++) dma_pool_run[i+n] = 0xFF;	// inside a lease
+				break;
+			}
+			// skip past the leased block
+			i += n;
+			i += (dma_pool_run[i] == 0xFF) ? 1 : dma_pool_run[i];
+		}
+		portEXIT_CRITICAL(&dma_pool_mux);
+	}
+	if (start >= 0) return dma_pool + (start * TFT_DMA_POOL_BLOCK);
+
+	tft_dma_pool_misses++;
+	return heap_caps_malloc(bytes, MALLOC_CAP_DMA);
+}
+
+//=================================
+void TFT_dma_release(void *buf)
+{
+	uint8_t *p = (uint8_t *)buf;
+
+	if (p == NULL) return;
+	if ((dma_pool == NULL) || (p < dma_pool) || (p >= (dma_pool + (TFT_DMA_POOL_BLOCKS * TFT_DMA_POOL_BLOCK)))) {
+		free(buf);		// leased from the heap
+		return;
+	}
+
+	int i = (p - dma_pool) / TFT_DMA_POOL_BLOCK;
+	portENTER_CRITICAL(&dma_pool_mux);
+	int n = dma_pool_run[i];
+	if (n != 0xFF) memset(dma_pool_run + i, 0, n);
+	portEXIT_CRITICAL(&dma_pool_mux);
 }
 
 //-------------------------------
@@ -85,6 +260,7 @@ esp_err_t IRAM_ATTR disp_select()
 //---------------------------------
 esp_err_t IRAM_ATTR disp_deselect()
 {
+	if (px_run_len) _px_flush();
 	wait_trans_finish(1);
 	return spi_lobo_device_deselect(tft_disp_spi);
 }
@@ -112,6 +288,7 @@ static void IRAM_ATTR _spi_transfer_start(spi_lobo_device_handle_t spi_dev, int
 // Send 1 byte display command, display must be selected
 //------------------------------------------------
 void IRAM_ATTR disp_spi_transfer_cmd(int8_t cmd) {
+	if (px_run_len) _px_flush();
 	// Wait for SPI bus ready
 	while (tft_disp_spi->host->hw->cmd.usr);
 
@@ -125,6 +302,7 @@ void IRAM_ATTR disp_spi_transfer_cmd(int8_t cmd) {
 // Send command with data to display, display must be selected
 //----------------------------------------------------------------------------------
 void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len) {
+	if (px_run_len) _px_flush();
 	// Wait for SPI bus ready
 	while (tft_disp_spi->host->hw->cmd.usr);
 
@@ -176,6 +354,9 @@ void IRAM_ATTR disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t le
 static void IRAM_ATTR disp_spi_transfer_addrwin(uint16_t x1, uint16_t x2, uint16_t y1, uint16_t y2) {
 	uint32_t wd;
 
+	// Pixels collected by drawPixel() go first
+	if (px_run_len) _px_flush();
+
     taskDISABLE_INTERRUPTS();
 	// Wait for SPI bus ready
 	while (tft_disp_spi->host->hw->cmd.usr);
@@ -237,65 +418,203 @@ static color_t IRAM_ATTR color2gs(color_t color)
     return _color;
 }
 
+#if CONFIG_TFT_FRAMEBUFFER || CONFIG_TFT_COLOR_BITS_16
+// Convert color to RGB565, bytes swapped to be sent high byte first
+//---------------------------------------------------------
+static inline uint16_t IRAM_ATTR color2rgb565(color_t color)
+{
+	if (tft_gray_scale) color = color2gs(color);
+	uint16_t c = ((uint16_t)(color.r & 0xF8) << 8) | ((uint16_t)(color.g & 0xFC) << 3) | (color.b >> 3);
+	return (c >> 8) | (c << 8);
+}
+#endif
+
+// Convert color to the format sent to the display
+//=============================================
+tft_pixel_t IRAM_ATTR TFT_pixel(color_t color)
+{
+#if CONFIG_TFT_COLOR_BITS_16
+	return color2rgb565(color);
+#else
+	return (tft_gray_scale) ? color2gs(color) : color;
+#endif
+}
+
+#if CONFIG_TFT_FRAMEBUFFER
+// ==== RAM framebuffer ===============================
+
+//------------------------------------------------------
+static inline color_t IRAM_ATTR rgb5652color(uint16_t c)
+{
+	c = (c >> 8) | (c << 8);
+	color_t color = {(c >> 8) & 0xF8, (c >> 3) & 0xFC, (c << 3) & 0xF8};
+	return color;
+}
+
+// Write 'len' colors into framebuffer window (x1,y1),(x2,y2), row by row,
+// from 'buf', or 'len' times buf[0] if 'rep' is set.
+// If 'px' is given, it holds RGB565 pixels to write instead of 'buf'
+//---------------------------------------------------------------------------------------------------------------------------
+static void IRAM_ATTR fb_write(int x1, int y1, int x2, int y2, color_t *buf, const uint16_t *px, uint32_t len, uint8_t rep)
+{
+	x1 -= TFT_STATIC_X_OFFSET;
+	x2 -= TFT_STATIC_X_OFFSET;
+	y1 -= TFT_STATIC_Y_OFFSET;
+	y2 -= TFT_STATIC_Y_OFFSET;
+
+	uint32_t w = x2 - x1 + 1;
+	uint16_t fill = (px) ? px[0] : color2rgb565(buf[0]);
+
+	for (int y = y1; (y <= y2) && (len > 0); y++) {
+		uint32_t n = (len < w) ? len : w;
+		int cx1 = (x1 < 0) ? 0 : x1;
+		int cx2 = x1 + n - 1;
+		if (cx2 >= tft_width) cx2 = tft_width - 1;
+
+		if ((y >= 0) && (y < tft_height) && (cx1 <= cx2)) {
+			uint16_t *row = tft_fb + (y * tft_width);
+			if (rep) {
+				for (int x = cx1; x <= cx2; x++) row[x] = fill;
+			}
+			else {
+				for (int x = cx1; x <= cx2; x++) row[x] = (px) ? px[x - x1] : color2rgb565(buf[x - x1]);
+			}
+			if ((fb_dirty_x1[y] < 0) || (cx1 < fb_dirty_x1[y])) fb_dirty_x1[y] = cx1;
+			if (cx2 > fb_dirty_x2[y]) fb_dirty_x2[y] = cx2;
+		}
+		if (rep == 0) {
+			if (px) px += n;
+			else buf += n;
+		}
+		len -= n;
+	}
+}
+
+// Read 'len' colors from framebuffer window (x1,y1),(x2,y2)
+//-------------------------------------------------------------------------------
+static void fb_read(int x1, int y1, int x2, int y2, color_t *buf, uint32_t len)
+{
+	int x = x1 - TFT_STATIC_X_OFFSET;
+	int y = y1 - TFT_STATIC_Y_OFFSET;
+
+	while (len--) {
+		if ((x >= 0) && (x < tft_width) && (y >= 0) && (y < tft_height)) *buf = rgb5652color(tft_fb[(y * tft_width) + x]);
+		buf++;
+		if (++x > (x2 - TFT_STATIC_X_OFFSET)) {
+			x = x1 - TFT_STATIC_X_OFFSET;
+			y++;
+		}
+	}
+}
+#endif
+
 // Set display pixel at given coordinates to given color
+// The pixel is added to the run of pixels being collected, see _px_flush()
 //------------------------------------------------------------------------
 void IRAM_ATTR drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel)
 {
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) {
+		fb_write(x, y, x, y, &color, NULL, 1, 1);
+		return;
+	}
+#endif
 	if (!(tft_disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
 
 	if (sel) {
 		if (disp_select()) return;
 	}
-	else wait_trans_finish(1);
-
-	uint32_t wd = 0;
-    color_t _color = color;
-	if (tft_gray_scale) _color = color2gs(color);
 
-    taskDISABLE_INTERRUPTS();
-	disp_spi_transfer_addrwin(x, x+1, y, y+1);
-
-	// Send RAM WRITE command
-    gpio_set_level(PIN_NUM_DC, 0);
-    tft_disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
-	tft_disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
-	tft_disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (tft_disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+	if (px_run_len) {
+		uint8_t dir = 0;
+		if (px_run_len < TFT_PX_RUN_MAX) {
+			if ((y == px_run_y) && (x == px_run_x + (int)px_run_len) && (px_run_dir != TFT_PX_RUN_V)) dir = TFT_PX_RUN_H;
+			else if ((x == px_run_x) && (y == px_run_y + (int)px_run_len) && (px_run_dir != TFT_PX_RUN_H)) dir = TFT_PX_RUN_V;
+		}
+		if (dir) px_run_dir = dir;
+		else _px_flush();
+	}
+	if (px_run_len == 0) {
+		px_run_x = x;
+		px_run_y = y;
+		px_run_dir = 0;
+	}
+	px_run[px_run_len++] = color;
 
-	wd = (uint32_t)_color.r;
-	wd |= (uint32_t)_color.g << 8;
-	wd |= (uint32_t)_color.b << 16;
+	if (sel) disp_deselect();
+}
 
-    // Set DC to 1 (data mode);
-	gpio_set_level(PIN_NUM_DC, 1);
+// Get the DMA descriptor sending 'size' bytes from 'data', looped if 'loop' is set.
+// Prepared only if not kept from an earlier send; the previous transfer must be finished.
+// A looped descriptor relies on the DMA engine as seen on the ESP32, not on
+// anything documented:
+//  - the owner bit is not checked before and not written back after a
+//    descriptor is read, so it can be read again on every pass
+//  - the DMA stops when the SPI transfer length is reached, it does not
+//    need an eof descriptor
+//  - a prefetched next pass is dropped by the DMA reset in wait_trans_finish()
+//  - the buffer is looped with 'size' bytes a pass, TFT_DMA_BUF_BYTES is kept
+//    a multiple of 4 so every pass starts word aligned
+//-------------------------------------------------------------------------------------
+static lldesc_t * IRAM_ATTR _dma_chain(const uint8_t *data, uint32_t size, uint8_t loop)
+{
+	int i;
 
-	tft_disp_spi->host->hw->data_buf[0] = wd;
-	tft_disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 23;
-	tft_disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (tft_disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+	for (i=0; i<TFT_DMA_CHAINS; i++) {
+		if ((dma_chain[i].data == data) && (dma_chain[i].size == size) && (dma_chain[i].loop == loop)) return &dma_chain_desc[i];
+	}
 
-    taskENABLE_INTERRUPTS();
-   if (sel) disp_deselect();
+	i = dma_chain_next;
+	dma_chain_next = (dma_chain_next + 1) % TFT_DMA_CHAINS;
+
+	lldesc_t *desc = &dma_chain_desc[i];
+	desc->size = (size + 3) & ~3;	// Buffer size is in words, the length sent in bytes
+	desc->length = size;
+	desc->buf = (uint8_t *)data;
+	desc->sosf = 0;
+	desc->owner = 1;
+	desc->eof = (loop) ? 0 : 1;
+	desc->qe.stqe_next = (loop) ? desc : NULL;
+
+	dma_chain[i].data = data;
+	dma_chain[i].size = size;
+	dma_chain[i].loop = loop;
+	return desc;
 }
 
+// Start sending 'size' bytes with DMA from the descriptors at 'desc'
 //-----------------------------------------------------------
-static void IRAM_ATTR _dma_send(uint8_t *data, uint32_t size)
+static void IRAM_ATTR _dma_start(lldesc_t *desc, uint32_t size)
 {
-    //Fill DMA descriptors
     spi_lobo_dmaworkaround_transfer_active(tft_disp_spi->host->dma_chan); //mark channel as active
-    spi_lobo_setup_dma_desc_links(tft_disp_spi->host->dmadesc_tx, size, data, false);
     tft_disp_spi->host->hw->user.usr_mosi_highpart=0;
-    tft_disp_spi->host->hw->dma_out_link.addr=(int)(&tft_disp_spi->host->dmadesc_tx[0]) & 0xFFFFF;
+    tft_disp_spi->host->hw->dma_out_link.addr=(int)(desc) & 0xFFFFF;
     tft_disp_spi->host->hw->dma_out_link.start=1;
     tft_disp_spi->host->hw->user.usr_mosi_highpart=0;
 
 	tft_disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = (size * 8) - 1;
 
 	_dma_sending = 1;
+	_dma_bytes = size;
+	tft_pixel_bytes += size;
 	// Start transfer
 	tft_disp_spi->host->hw->cmd.usr = 1;
 }
 
+//-----------------------------------------------------------
+static void IRAM_ATTR _dma_send(uint8_t *data, uint32_t size)
+{
+	lldesc_t *desc;
+
+	if (size <= SPI_MAX_DMA_LEN) desc = _dma_chain(data, size, 0);
+	else {
+		//Fill DMA descriptors
+		desc = tft_disp_spi->host->dmadesc_tx;
+		spi_lobo_setup_dma_desc_links(desc, size, data, false);
+	}
+	_dma_start(desc, size);
+}
+
 //---------------------------------------------------------------------------
 static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
 {
@@ -306,6 +625,24 @@ static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
 	int wbits = 0;
 
     taskDISABLE_INTERRUPTS();
+#if CONFIG_TFT_COLOR_BITS_16
+	uint16_t _pixel = color2rgb565(color[0]);
+
+	while (len) {
+		if (rep == 0) _pixel = color2rgb565(color[cidx]);
+
+		wd |= (uint32_t)_pixel << wbits;
+		wbits += 16;
+		if (wbits == 32) {
+			bits += wbits;
+			wbits = 0;
+			tft_disp_spi->host->hw->data_buf[idx++] = wd;
+			wd = 0;
+		}
+    	len--;					// Decrement colors counter
+        if (rep == 0) cidx++;	// if not repeating color, increment color buffer index
+    }
+#else
 	color_t _color = color[0];
 	if ((rep) && (tft_gray_scale)) _color = color2gs(color[0]);
 
@@ -343,14 +680,122 @@ static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
     	len--;					// Decrement colors counter
         if (rep == 0) cidx++;	// if not repeating color, increment color buffer index
     }
+#endif
+	if (wbits) {
+		// Last, partly filled word
+		bits += wbits;
+		tft_disp_spi->host->hw->data_buf[idx++] = wd;
+	}
 	if (bits) {
 		while (tft_disp_spi->host->hw->cmd.usr);						// Wait for SPI bus ready
 		tft_disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = bits-1;	// set number of bits to be sent
         tft_disp_spi->host->hw->cmd.usr = 1;							// Start transfer
+		tft_pixel_bytes += bits / 8;
 	}
     taskENABLE_INTERRUPTS();
 }
 
+// Let a device with higher priority waiting for the bus use it, between the parts
+// of a display transfer. If it did, the transfer registers and the DMA are set up
+// for sending to the display again. No transfer may be in progress.
+// On error the display does not own the bus anymore and the transfer must be aborted
+//-------------------------------------
+static esp_err_t IRAM_ATTR _disp_yield()
+{
+	bool yielded;
+	esp_err_t ret = spi_lobo_device_yield(tft_disp_spi, &yielded);
+	if ((ret != ESP_OK) || (!yielded)) return ret;
+
+	tft_disp_spi->host->hw->user.usr_mosi_highpart = 0;
+	tft_disp_spi->host->hw->user.usr_mosi = 1;
+	tft_disp_spi->host->hw->miso_dlen.usr_miso_dbitlen = 0;
+	tft_disp_spi->host->hw->user.usr_miso = 0;
+
+	// Reset DMA
+	tft_disp_spi->host->hw->dma_conf.val |= SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST;
+	tft_disp_spi->host->hw->dma_out_link.start=0;
+	tft_disp_spi->host->hw->dma_in_link.start=0;
+	tft_disp_spi->host->hw->dma_conf.val &= ~(SPI_OUT_RST|SPI_IN_RST|SPI_AHBM_RST|SPI_AHBM_FIFO_RST);
+	tft_disp_spi->host->hw->dma_conf.out_data_burst_en=1;
+	return ESP_OK;
+}
+
+// Send 'len' colors from the SPI registers, without DMA buffers
+//---------------------------------------------------------------------------------
+static void IRAM_ATTR _direct_send_chunks(color_t *color, uint32_t len, uint8_t rep)
+{
+	uint32_t max_colors = 512 / (sizeof(tft_pixel_t) * 8);
+	while (len > 0) {
+		uint32_t n = (len > max_colors) ? max_colors : len;
+		wait_trans_finish(0);
+		_direct_send(color, n, rep);
+		if (rep == 0) color += n;
+		len -= n;
+	}
+}
+
+// Send 'bytes' of pixel data from DMA capable buffer 'data',
+// in parts of whole pixels when longer than the DMA descriptors cover
+//-----------------------------------------------------------------
+static void IRAM_ATTR _dma_send_chunks(uint8_t *data, uint32_t bytes)
+{
+	uint32_t max_bytes = tft_disp_spi->host->max_transfer_sz - (tft_disp_spi->host->max_transfer_sz % sizeof(tft_pixel_t));
+	while (bytes > 0) {
+		uint32_t n = ((max_bytes) && (bytes > max_bytes)) ? max_bytes : bytes;
+		wait_trans_finish(0);
+		_dma_send(data, n);
+		data += n;
+		bytes -= n;
+	}
+}
+
+// Send 'len' colors converted with TFT_pixel(), through the DMA buffers.
+// Each chunk is converted into one buffer while the other one is sent.
+//----------------------------------------------------------------------
+static void IRAM_ATTR _dma_send_colors(color_t *color, uint32_t len)
+{
+	int b = 0;
+
+	if (dma_buf[0] == NULL) {
+		_direct_send_chunks(color, len, 0);
+		return;
+	}
+	wait_trans_finish(0);
+	dma_fill_len = 0;
+
+	while (len > 0) {
+		uint32_t n = (len > TFT_DMA_BUF_PIXELS) ? TFT_DMA_BUF_PIXELS : len;
+		tft_pixel_t *p = dma_buf[b];
+
+		// Sent two chunks ago, before the wait for the previous one
+		for (uint32_t i=0; i<n; i++) {
+#if CONFIG_TFT_COLOR_BITS_16
+			p[i] = color2rgb565(color[i]);
+#else
+			p[i] = color2gs(color[i]);
+#endif
+		}
+		wait_trans_finish(0);
+		_dma_send((uint8_t *)p, n*sizeof(tft_pixel_t));
+		color += n;
+		len -= n;
+		b ^= 1;
+	}
+}
+
+// Send RAM WRITE command, leaves DC in data mode
+//-----------------------------------
+static void IRAM_ATTR _send_ramwr()
+{
+    gpio_set_level(PIN_NUM_DC, 0);
+    tft_disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
+	tft_disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
+	tft_disp_spi->host->hw->cmd.usr = 1;		// Start transfer
+	while (tft_disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+
+	gpio_set_level(PIN_NUM_DC, 1);								// Set DC to 1 (data mode);
+}
+
 // ================================================================
 // === Main function to send data to display ======================
 // If  rep==true:  repeat sending color data to display 'len' times
@@ -358,92 +803,190 @@ static void IRAM_ATTR _direct_send(color_t *color, uint32_t len, uint8_t rep)
 // ** Device must already be selected and address window set **
 // ================================================================
 //----------------------------------------------------------------------------------------------
-static void IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t rep, uint8_t wait)
+static esp_err_t IRAM_ATTR _TFT_pushColorRep(color_t *color, uint32_t len, uint8_t rep, uint8_t wait)
 {
-	if (len == 0) return;
-	if (!(tft_disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
+	esp_err_t ret = ESP_OK;
 
-	// Send RAM WRITE command
-    gpio_set_level(PIN_NUM_DC, 0);
-    tft_disp_spi->host->hw->data_buf[0] = (uint32_t)TFT_RAMWR;
-	tft_disp_spi->host->hw->mosi_dlen.usr_mosi_dbitlen = 7;
-	tft_disp_spi->host->hw->cmd.usr = 1;		// Start transfer
-	while (tft_disp_spi->host->hw->cmd.usr);	// Wait for SPI bus ready
+	if (len == 0) return ESP_OK;
+	if (!(tft_disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return ESP_OK;
 
-	gpio_set_level(PIN_NUM_DC, 1);								// Set DC to 1 (data mode);
+	_send_ramwr();
 
-	if ((len*24) <= 512) {
+	if ((len*sizeof(tft_pixel_t)*8) <= 512) {
 
 		_direct_send(color, len, rep);
 
 	}
 	else if (rep == 0)  {
 		// ==== use DMA transfer ====
-		// ** Prepare data
-		if (tft_gray_scale) {
-			for (int n=0; n<len; n++) {
-				color[n] = color2gs(color[n]);
-			}
-	    }
-
-	    _dma_send((uint8_t *)color, len*3);
+#if !CONFIG_TFT_COLOR_BITS_16
+		if (tft_gray_scale == 0) {
+			// Already in the display format
+			_dma_send_chunks((uint8_t *)color, len*sizeof(tft_pixel_t));
+		}
+		else
+#endif
+		_dma_send_colors(color, len);
+	}
+	else if (dma_buf[0] == NULL) {
+		// ==== Repeat color, no DMA buffers ====
+		_direct_send_chunks(color, len, 1);
 	}
 	else {
 		// ==== Repeat color, more than 512 bits total ====
 
-		color_t _color;
-		uint32_t buf_colors;
-		int buf_bytes, to_send;
+		tft_pixel_t _pixel = TFT_pixel(color[0]);
+		uint32_t buf_colors = (len > TFT_DMA_BUF_PIXELS) ? TFT_DMA_BUF_PIXELS : len;
+		uint32_t to_send;
 
-		/*
-		to_send = len;
-		while (to_send > 0) {
+		// Fill the color buffer, unless it holds the color from the last fill
+		if ((buf_colors > dma_fill_len) || (memcmp(&_pixel, &dma_fill_pixel, sizeof(tft_pixel_t)) != 0)) {
 			wait_trans_finish(0);
-			_direct_send(color, ((to_send > 21) ? 21 : to_send), rep);
-			to_send -= 21;
+			for (uint32_t i=0; i<buf_colors; i++) {
+				dma_buf[0][i] = _pixel;
+			}
+			dma_fill_pixel = _pixel;
+			dma_fill_len = buf_colors;
 		}
-		*/
 
-		buf_colors = ((len > (tft_width*2)) ? (tft_width*2) : len);
-		buf_bytes = buf_colors * 3;
-
-		// Prepare color buffer of maximum 2 color lines
-		trans_cline = heap_caps_malloc(buf_bytes, MALLOC_CAP_DMA);
-		if (trans_cline == NULL) return;
-
-		// Prepare fill color
-		if (tft_gray_scale) _color = color2gs(color[0]);
-		else _color = color[0];
-
-		// Fill color buffer with fill color
-		for (uint32_t i=0; i<buf_colors; i++) {
-			trans_cline[i] = _color;
+#if CONFIG_TFT_DMA_LOOPED_FILL
+		// Send 'len' colors in DMA runs looping over the buffer
+		lldesc_t *desc = _dma_chain((uint8_t *)dma_buf[0], buf_colors*sizeof(tft_pixel_t), 1);
+		to_send = len * sizeof(tft_pixel_t);
+		while (to_send > 0) {
+			uint32_t n = (to_send > TFT_DMA_RUN_BYTES) ? TFT_DMA_RUN_BYTES : to_send;
+			wait_trans_finish(0);
+			// Between the runs of a large fill a device with higher priority can use the bus
+			ret = _disp_yield();
+			if (ret != ESP_OK) return ret;
+			_dma_start(desc, n);
+			to_send -= n;
 		}
-
-		// Send 'len' colors
+#else
+		// Send 'len' colors, the same buffer every time
 		to_send = len;
 		while (to_send > 0) {
+			uint32_t n = (to_send > buf_colors) ? buf_colors : to_send;
 			wait_trans_finish(0);
-			_dma_send((uint8_t *)trans_cline, ((to_send > buf_colors) ? buf_bytes : (to_send*3)));
-			to_send -= buf_colors;
+			// Between the parts of a large fill a device with higher priority can use the bus
+			ret = _disp_yield();
+			if (ret != ESP_OK) return ret;
+			_dma_send((uint8_t *)dma_buf[0], n*sizeof(tft_pixel_t));
+			to_send -= n;
 		}
+#endif
 	}
 
 	if (wait) wait_trans_finish(1);
+	return ret;
+}
+
+// Send 'len' pixels, converted with TFT_pixel(), from DMA capable buffer 'buf'
+// ** Device must already be selected and address window set **
+//-----------------------------------------------------------------
+static void IRAM_ATTR _TFT_pushPixels(tft_pixel_t *buf, uint32_t len)
+{
+	if (len == 0) return;
+	if (!(tft_disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return;
+
+	_send_ramwr();
+	_dma_send_chunks((uint8_t *)buf, len*sizeof(tft_pixel_t));
+}
+
+#if CONFIG_TFT_FRAMEBUFFER
+// Queue 'len' pixels from DMA capable buffer 'buf' in 'trans', for the SPI interrupt to send.
+// Returns true if queued, the transaction is returned by spi_lobo_get_trans_result() when sent.
+// Otherwise they are sent as by _TFT_pushPixels().
+// ** Device must already be selected and address window set **
+//-----------------------------------------------------------------------------------------------
+static bool IRAM_ATTR _TFT_queuePixels(tft_pixel_t *buf, uint32_t len, spi_lobo_transaction_t *trans)
+{
+	uint32_t bytes = len * sizeof(tft_pixel_t);
+
+	if ((len == 0) || (bytes > tft_disp_spi->host->max_transfer_sz)) {
+		_TFT_pushPixels(buf, len);
+		return false;
+	}
+	if (!(tft_disp_spi->cfg.flags & LB_SPI_DEVICE_HALFDUPLEX)) return false;
+
+	_send_ramwr();
+	memset(trans, 0, sizeof(spi_lobo_transaction_t));
+	trans->length = bytes * 8;
+	trans->tx_buffer = buf;
+	if (spi_lobo_queue_trans(tft_disp_spi, trans) != ESP_OK) {
+		// No DMA channel or interrupt
+		_dma_send_chunks((uint8_t *)buf, bytes);
+		return false;
+	}
+	tft_pixel_bytes += bytes;
+	return true;
+}
+#endif
+
+// Send the run of pixels collected by drawPixel() as one window
+// ** Device must already be selected **
+//-------------------------------
+static void IRAM_ATTR _px_flush()
+{
+	uint32_t len = px_run_len;
+	int x2 = px_run_x;
+	int y2 = px_run_y;
+
+	if (len == 0) return;
+	px_run_len = 0;
+	if (px_run_dir == TFT_PX_RUN_V) y2 += len - 1;
+	else x2 += len - 1;
+
+	wait_trans_finish(0);
+	disp_spi_transfer_addrwin(px_run_x, x2, px_run_y, y2);
+	_TFT_pushColorRep(px_run, len, 0, 0);
 }
 
 // Write 'len' color data to TFT 'window' (x1,y2),(x2,y2)
-//-------------------------------------------------------------------------------------------
-void IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, uint32_t len)
+// Returns an error if the display lost the SPI bus, the fill is then cut short
+//------------------------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, uint32_t len)
 {
-	if (disp_select() != ESP_OK) return;
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) {
+		fb_write(x1, y1, x2, y2, &color, NULL, len, 1);
+		return ESP_OK;
+	}
+#endif
+	esp_err_t ret = disp_select();
+	if (ret != ESP_OK) return ret;
 
 	// ** Send address window **
 	disp_spi_transfer_addrwin(x1, x2, y1, y2);
 
-	_TFT_pushColorRep(&color, len, 1, 1);
+	ret = _TFT_pushColorRep(&color, len, 1, 1);
+	if (ret != ESP_OK) return _disp_bus_lost(ret, "fill");
 
-	disp_deselect();
+	return disp_deselect();
+}
+
+// Write 'len' pixels of 'color' to TFT 'window' (x1,y2),(x2,y2)
+// Same as TFT_pushColorRep(), for drawing many small windows in a row
+// ** Device must already be selected **
+// Returns an error, sending nothing more, once the display lost the SPI bus
+//------------------------------------------------------------------------------------------
+esp_err_t IRAM_ATTR send_color(int x1, int y1, int x2, int y2, color_t color, uint32_t len)
+{
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) {
+		fb_write(x1, y1, x2, y2, &color, NULL, len, 1);
+		return ESP_OK;
+	}
+#endif
+	// Lost in an earlier window of the same drawing
+	if (!tft_disp_spi->cfg.selected) return ESP_ERR_INVALID_STATE;
+
+	wait_trans_finish(0);
+	// ** Send address window **
+	disp_spi_transfer_addrwin(x1, x2, y1, y2);
+	esp_err_t ret = _TFT_pushColorRep(&color, len, 1, 0);
+	if (ret != ESP_OK) return _disp_bus_lost(ret, "fill");
+	return ESP_OK;
 }
 
 // Write 'len' color data to TFT 'window' (x1,y2),(x2,y2) from given buffer
@@ -451,11 +994,157 @@ void IRAM_ATTR TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t color, u
 //-----------------------------------------------------------------------------------
 void IRAM_ATTR send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf)
 {
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) {
+		fb_write(x1, y1, x2, y2, buf, NULL, len, 0);
+		return;
+	}
+#endif
+	wait_trans_finish(0);
 	// ** Send address window **
 	disp_spi_transfer_addrwin(x1, x2, y1, y2);
 	_TFT_pushColorRep(buf, len, 0, 0);
 }
 
+// Write 'len' pixels from DMA capable buffer 'buf' to TFT 'window' (x1,y2),(x2,y2)
+// The pixels must be converted with TFT_pixel(), 'buf' is left unchanged
+//-------------------------------------------------------------------------------------------
+void IRAM_ATTR send_pixels(int x1, int y1, int x2, int y2, uint32_t len, tft_pixel_t *buf)
+{
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) {
+#if CONFIG_TFT_COLOR_BITS_16
+		fb_write(x1, y1, x2, y2, NULL, buf, len, 0);
+#else
+		fb_write(x1, y1, x2, y2, buf, NULL, len, 0);
+#endif
+		return;
+	}
+#endif
+	wait_trans_finish(0);
+	// ** Send address window **
+	disp_spi_transfer_addrwin(x1, x2, y1, y2);
+	_TFT_pushPixels(buf, len);
+}
+
+// ==== RAM framebuffer ===============================
+
+// Allocate the framebuffer, all drawing goes to RAM from now on.
+// The display is expected to be black, as the framebuffer starts.
+//================================
+esp_err_t TFT_framebuffer_init()
+{
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) return ESP_OK;
+
+	int rows = (tft_width > tft_height) ? tft_width : tft_height;
+	tft_fb = heap_caps_calloc(tft_width * tft_height, sizeof(uint16_t), MALLOC_CAP_8BIT);
+	fb_dirty_x1 = malloc(rows * sizeof(int16_t));
+	fb_dirty_x2 = malloc(rows * sizeof(int16_t));
+
+	if ((tft_fb == NULL) || (fb_dirty_x1 == NULL) || (fb_dirty_x2 == NULL) || (dma_buf[0] == NULL)) {
+		printf("TFT: no memory for a %dx%d framebuffer, drawing directly\r\n", tft_width, tft_height);
+		free(tft_fb);
+		free(fb_dirty_x1);
+		free(fb_dirty_x2);
+		tft_fb = NULL;
+		fb_dirty_x1 = fb_dirty_x2 = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+	memset(fb_dirty_x1, 0xFF, rows * sizeof(int16_t));
+	memset(fb_dirty_x2, 0xFF, rows * sizeof(int16_t));
+	return ESP_OK;
+#else
+	return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// Send the areas of the framebuffer changed since the last flush.
+// Consecutive changed rows are sent as one rectangle, spanning all
+// their changed columns.
+// Returns the number of pixels sent
+//====================
+uint32_t TFT_flush()
+{
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb == NULL) return 0;
+
+	uint32_t sent = 0;
+	int y = 0;
+	int b = 0;
+	spi_lobo_transaction_t trans[2];	// Parts sent by the SPI interrupt, one per buffer
+	spi_lobo_transaction_t *done;
+	int queued = 0;
+
+	if (disp_select() != ESP_OK) return 0;
+	dma_fill_len = 0;
+
+	while (y < tft_height) {
+		if (fb_dirty_x1[y] < 0) {
+			y++;
+			continue;
+		}
+		int y1 = y;
+		int x1 = fb_dirty_x1[y];
+		int x2 = fb_dirty_x2[y];
+		while ((++y < tft_height) && (fb_dirty_x1[y] >= 0)) {
+			if (fb_dirty_x1[y] < x1) x1 = fb_dirty_x1[y];
+			if (fb_dirty_x2[y] > x2) x2 = fb_dirty_x2[y];
+		}
+
+		int w = x2 - x1 + 1;
+		int rows = TFT_DMA_BUF_BYTES / (w * sizeof(tft_pixel_t));
+
+		for (int ry = y1; ry < y; ry += rows) {
+			int ry2 = ((ry + rows) < y) ? (ry + rows - 1) : (y - 1);
+			uint32_t len = (ry2 - ry + 1) * w;
+
+			// Copied while the previous part is sent from the other buffer,
+			// the part before it was collected before that one was queued
+			tft_pixel_t *p = dma_buf[b];
+			for (int r = ry; r <= ry2; r++) {
+				uint16_t *row = tft_fb + (r * tft_width);
+#if CONFIG_TFT_COLOR_BITS_16
+				// Already in the display format
+				memcpy(p, row + x1, w * sizeof(uint16_t));
+				p += w;
+#else
+				for (int x = x1; x <= x2; x++) *p++ = rgb5652color(row[x]);
+#endif
+			}
+
+			// The previous part must be out before the window changes
+			if (queued) {
+				spi_lobo_get_trans_result(tft_disp_spi, &done, portMAX_DELAY);
+				queued--;
+			}
+			wait_trans_finish(0);
+			esp_err_t ret = _disp_yield();
+			if (ret != ESP_OK) {
+				// The rows not sent stay changed for the next flush
+				_disp_bus_lost(ret, "flush");
+				return sent;
+			}
+			disp_spi_transfer_addrwin(x1 + TFT_STATIC_X_OFFSET, x2 + TFT_STATIC_X_OFFSET, ry + TFT_STATIC_Y_OFFSET, ry2 + TFT_STATIC_Y_OFFSET);
+			if (_TFT_queuePixels(dma_buf[b], len, &trans[b])) queued++;
+			sent += len;
+			b ^= 1;
+		}
+
+		for (int r = y1; r < y; r++) {
+			fb_dirty_x1[r] = -1;
+			fb_dirty_x2[r] = -1;
+		}
+	}
+
+	if (queued) spi_lobo_get_trans_result(tft_disp_spi, &done, portMAX_DELAY);
+	disp_deselect();
+	return sent;
+#else
+	return 0;
+#endif
+}
+
 // Reads 'len' pixels/colors from the TFT's GRAM 'window'
 // 'buf' is an array of bytes with 1st byte reserved for reading 1 dummy byte
 // and the rest is actually an array of color_t values
@@ -468,6 +1157,14 @@ int IRAM_ATTR read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, u
     memset(&t, 0, sizeof(t));  //Zero out the transaction
 	memset(buf, 0, len*sizeof(color_t));
 
+#if CONFIG_TFT_FRAMEBUFFER
+	if (tft_fb) {
+		// 1st byte is the dummy byte read from the display
+		fb_read(x1, y1, x2, y2, (color_t *)(buf+1), len);
+		return ESP_OK;
+	}
+#endif
+
 	if (set_sp) {
 		if (disp_deselect() != ESP_OK) return -1;
 		// Change spi clock if needed
@@ -932,6 +1629,12 @@ void TFT_display_init()
 	}
 	else assert(0);
 
+#if CONFIG_TFT_COLOR_BITS_16
+	// 16-bit interface pixel format, RGB565
+	uint8_t pixfmt = DISP_COLOR_BITS_16;
+	disp_spi_transfer_cmd_data(TFT_CMD_PIXFMT, &pixfmt, 1);
+#endif
+
     ret = disp_deselect();
 	assert(ret==ESP_OK);
 
@@ -226,7 +226,7 @@
 // Configuration for other boards, set the correct values for the display used
 //----------------------------------------------------------------------------
 #define DISP_COLOR_BITS_24	0x66
-//#define DISP_COLOR_BITS_16	0x55  // Do not use!
+#define DISP_COLOR_BITS_16	0x55	// With CONFIG_TFT_COLOR_BITS_16
 
 #define TFT_INVERT_ROTATION 0
 #define TFT_INVERT_ROTATION1 1
@@ -327,6 +327,19 @@ typedef struct __attribute__((__packed__)) {
 	uint8_t b;
 } color_t ;
 
+// Pixel in the format sent to the display
+#if CONFIG_TFT_COLOR_BITS_16
+typedef uint16_t tft_pixel_t;	// RGB565, high byte first in memory
+#else
+typedef color_t tft_pixel_t;	// 8 bits per color, 6 of them used
+#endif
+
+// Bytes of pixel data sent to the display
+extern uint32_t tft_pixel_bytes;
+
+// DMA buffers leased from the heap because the pool had no room for them
+extern uint32_t tft_dma_pool_misses;
+
 // ==== Display commands constants ====
 #define TFT_INVOFF     0x20
 #define TFT_INVONN     0x21
@@ -730,8 +743,11 @@ esp_err_t wait_trans_finish(uint8_t free_line);
 void disp_spi_transfer_cmd(int8_t cmd);
 void disp_spi_transfer_cmd_data(int8_t cmd, uint8_t *data, uint32_t len);
 void drawPixel(int16_t x, int16_t y, color_t color, uint8_t sel);
+esp_err_t send_color(int x1, int y1, int x2, int y2, color_t color, uint32_t len);
 void send_data(int x1, int y1, int x2, int y2, uint32_t len, color_t *buf);
-void TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t data, uint32_t len);
+void send_pixels(int x1, int y1, int x2, int y2, uint32_t len, tft_pixel_t *buf);
+tft_pixel_t TFT_pixel(color_t color);
+esp_err_t TFT_pushColorRep(int x1, int y1, int x2, int y2, color_t data, uint32_t len);
 int read_data(int x1, int y1, int x2, int y2, int len, uint8_t *buf, uint8_t set_sp);
 color_t readPixel(int16_t x, int16_t y);
 int touch_get_data(uint8_t type);
@@ -770,6 +786,34 @@ void TFT_PinsInit();
 //======================
 void TFT_display_init();
 
+// Allocate the pool of DMA capable buffers (CONFIG_TFT_DMA_POOL_SIZE bytes)
+// the drawing code leases its pixel buffers from
+// Returns ESP_ERR_NO_MEM if it could not be allocated, pixels are then
+// sent without DMA and buffers allocated from the heap
+//================================
+esp_err_t TFT_dma_pool_init();
+
+// Lease a DMA capable buffer of 'bytes' from the pool, from the heap if the
+// pool has no room for it. Returns NULL only if both are exhausted
+//=================================
+void *TFT_dma_lease(uint32_t bytes);
+
+// Give back a buffer from TFT_dma_lease()
+//=================================
+void TFT_dma_release(void *buf);
+
+// Allocate the RAM framebuffer (CONFIG_TFT_FRAMEBUFFER)
+// All drawing goes to the framebuffer afterwards, until TFT_flush() sends it
+// Flushed through the DMA buffer pool, TFT_dma_pool_init() must be called first
+// Returns ESP_ERR_NO_MEM if it could not be allocated, drawing then goes to the display
+//================================
+esp_err_t TFT_framebuffer_init();
+
+// Send the framebuffer areas changed since the last flush to the display
+// Returns the number of pixels sent, 0 if there is no framebuffer
+//====================
+uint32_t TFT_flush();
+
 //===================
 void stmpe610_Init();
 
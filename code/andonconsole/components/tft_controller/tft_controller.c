@@ -56,6 +56,9 @@ void _init_TFT(){
 	printf("SPI: attached display device, speed=%lu\r\n", spi_lobo_get_speed(spi));
 	printf("SPI: bus uses native pins: %s\r\n", spi_lobo_uses_native_pins(spi) ? "true" : "false");
 
+	// ==== Pixel buffers, leased by the drawing code ====
+	if (TFT_dma_pool_init() == ESP_OK) printf("TFT: %d byte DMA buffer pool\r\n", CONFIG_TFT_DMA_POOL_SIZE);
+
     // ================================
 	// ==== Initialize the Display ====
 
@@ -87,4 +90,9 @@ void _init_TFT(){
 	TFT_setRotation(LANDSCAPE);
 	TFT_setFont(DEFAULT_FONT, NULL);
 	TFT_resetclipwin();
+
+#if CONFIG_TFT_FRAMEBUFFER
+	// ==== Draw into RAM, sent with TFT_flush() ====
+	if (TFT_framebuffer_init() == ESP_OK) printf("TFT: %dx%d framebuffer\r\n", tft_width, tft_height);
+#endif
 }
\ No newline at end of file
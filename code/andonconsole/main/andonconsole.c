@@ -54,6 +54,8 @@ DEALINGS IN THE SOFTWARE. */
 #include <stdarg.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -70,6 +72,14 @@ DEALINGS IN THE SOFTWARE. */
 #include "cJSON.h"
 #include "mdns.h" 
 #include "soc/gpio_struct.h"
+#include "esp_timer.h"
+#include "callcapture.h"
+#include "callframe.h"
+#include "benchmark.h"
+#include "journal.h"
+#include "telemetry.h"
+#include "catalog.h"
+#include "buttons.h"
 
 
 
@@ -98,6 +108,19 @@ DEALINGS IN THE SOFTWARE. */
 
 #define DEBUG 2        // Lights up to ESP_LOGs
 
+// Tasks, network I/O next to the WiFi stack on core 0, capture and display on core 1
+#define INPUT_CORE      1
+#define INPUT_PRIO      10
+#define NETWORK_CORE    0
+#define NETWORK_PRIO    6
+#define UI_CORE         1
+#define UI_PRIO         4
+
+#define NET_QUEUE_LEN     16    // States waiting for the network task
+#define BUTTON_QUEUE_LEN  16    // Button events waiting for the display task
+#define CATALOG_QUEUE_LEN 16    // Catalog messages waiting for the display task, one batch each
+#define NET_RETRY_MS      10    // Retry period of a state the network queue had no room for
+
 // Define registers
 #define GPIO_OUT_W1TS_REG 0x3FF44008
 #define GPIO_OUT_W1TC_REG 0x3FF4400C
@@ -158,6 +181,10 @@ struct Callrecord calls[3] = {
     {NULL,NULL,NULL}
 };
 
+// Held while department and calls are changed, they are read by the input
+// and network tasks
+static SemaphoreHandle_t state_lock = NULL;
+
 // Set Callrecord
 void setCallrecord(struct Callrecord *record, const char *status, const char *desc, const char *to) {
     if (status == NULL || desc == NULL || to == NULL) {
@@ -165,6 +192,8 @@ void setCallrecord(struct Callrecord *record, const char *status, const char *de
         return;
     }
 
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+
     // Free previous memory if allocated
     if (record->status != NULL) free(record->status);
     if (record->mancalldesc != NULL) free(record->mancalldesc);
@@ -184,11 +213,15 @@ void setCallrecord(struct Callrecord *record, const char *status, const char *de
 
     if (record->mancallto != NULL) strcpy(record->mancallto, to);
     else ESP_LOGE(TAG_CODE, "Failed to allocate memory for mancallto");
+
+    xSemaphoreGive(state_lock);
 }
 
 
 // Set Deptrecord
 void setDeptrecord(struct Deptrecord *record, const char *dept, const char *id) {
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+
     if (record->deptname != NULL) free (record->deptname);
     if (record->deptid   != NULL) free (record->deptid);
 
@@ -200,6 +233,8 @@ void setDeptrecord(struct Deptrecord *record, const char *dept, const char *id)
     if (record->deptid != NULL) {
         strcpy(record->deptid, id);
     }
+
+    xSemaphoreGive(state_lock);
 }
 
 struct Callrecord callRecords[MAX_CALL_RECORDS];
@@ -227,31 +262,18 @@ void initialiseDeptRecord() {
 }
 
 // For testing purposes, comment when in operation
+// Copies are allocated, catalog updates from the server free them
 void testCallRecords() {
-    // Test call 1
-    callRecords[0].status = "Red";
-    callRecords[0].mancalldesc = "Test Problem1";
-    callRecords[0].mancallto = "Test person1";
-
-    // Test call 2
-    callRecords[1].status = "Yellow";
-    callRecords[1].mancalldesc = "Test Problem2";
-    callRecords[1].mancallto = "Test person2";
-
-    // Test call 3
-    callRecords[2].status = "Green";
-    callRecords[2].mancalldesc = "Test Problem3";
-    callRecords[2].mancallto = "Test person3";
+    setCallrecord(&callRecords[0], "Red", "Test Problem1", "Test person1");
+    setCallrecord(&callRecords[1], "Yellow", "Test Problem2", "Test person2");
+    setCallrecord(&callRecords[2], "Green", "Test Problem3", "Test person3");
 
     callRecordCount = 3;
 }
 
 void testDeptRecords() {
-    deptRecords[0].deptname = "Department 1";
-    deptRecords[0].deptid = "1";
-
-    deptRecords[1].deptname = "Department 2";
-    deptRecords[1].deptid = "2";
+    setDeptrecord(&deptRecords[0], "Department 1", "1");
+    setDeptrecord(&deptRecords[1], "Department 2", "2");
 
     deptRecordCount = 2;
 }
@@ -599,6 +621,133 @@ void wifi_init_sta(void)
     ESP_LOGI(TAG_WIFI, "wifi_init_sta finished.");
 }
 
+// States for the network task, and button presses for the display task
+static QueueHandle_t net_queue = NULL;
+static QueueHandle_t button_queue = NULL;
+static QueueHandle_t catalog_queue = NULL;      // Catalog batches (catalog_batch_t *), applied by the display task
+static uint32_t catalog_dropped = 0;            // Catalog messages lost, see catalog_receive()
+static volatile uint8_t call_mask = 0;          // Bit n set if call n+1 is active
+static volatile bool net_overflow = false;      // A state did not fit in net_queue
+static uint32_t net_dropped = 0;
+
+// State of the console, bit n of 'active' set if call n+1 is active
+static void current_callframe(uint8_t active, callframe_t *frame)
+{
+    *frame = (callframe_t) {
+        .consoleid  = CONSOLE_ID,       // Define ConsoleID
+        .department = department.deptid,
+        .active     = active,
+        .status     = {calls[0].status, calls[1].status, calls[2].status},
+        .oldcall    = CALLFRAME_LIVE,
+    };
+}
+
+// Hands a copy of the current state to the network task, never blocks.
+// If the queue is full the input task posts the latest state later.
+static void post_state(int64_t timestamp)
+{
+    journal_entry_t state;
+    callframe_t frame;
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    current_callframe(call_mask, &frame);
+    journal_entry(&frame, timestamp, &state);
+    xSemaphoreGive(state_lock);
+
+    if (xQueueSend(net_queue, &state, 0) != pdTRUE) {
+        net_overflow = true;
+        net_dropped++;
+    } else {
+        net_overflow = false;
+    }
+}
+
+// Wakes the display task to apply the catalog updates queued
+static void wake_ui(void)
+{
+    button_event_t evt = {
+        .timestamp = esp_timer_get_time(),
+        .type      = BUTTON_WAKE,
+    };
+
+    // A full queue wakes the task anyway
+    xQueueSend(button_queue, &evt, 0);
+}
+
+// Sends a changed department or status promptly
+void notify_state_change(void) {
+    if (net_queue != NULL) post_state(esp_timer_get_time());
+}
+
+// Hands the batch of a catalog message to the display task, never blocks
+static void catalog_post(const char *buf, size_t len)
+{
+    catalog_batch_t *batch = catalog_parse(buf, len);
+    if (batch == NULL) return;
+
+    if (xQueueSend(catalog_queue, &batch, 0) != pdTRUE) {
+        // The display task is woken for every batch, it is stuck
+        catalog_dropped++;
+        ESP_LOGE(TAG_SOCK, "Catalog queue full, %d updates dropped (%lu messages so far)",
+                 batch->count, (unsigned long)catalog_dropped);
+        free(batch);
+        return;
+    }
+    wake_ui();
+}
+
+// Text messages received in parts, longer than the client's buffer or
+// sent as several frames, are put back together before parsing
+static char *catalog_msg = NULL;
+static size_t catalog_msg_len = 0;
+
+static void catalog_receive(const esp_websocket_event_data_t *data)
+{
+    bool start = data->op_code == 0x01 && data->payload_offset == 0;
+    bool last = data->fin && data->payload_offset + data->data_len >= data->payload_len;
+
+    // Whole message in one part, parsed in place
+    if (start && last && catalog_msg == NULL) {
+        catalog_post(data->data_ptr, data->data_len);
+        return;
+    }
+
+    if (start) {
+        if (catalog_msg != NULL) {
+            catalog_dropped++;
+            ESP_LOGE(TAG_SOCK, "Text message cut short by the next one, dropped");
+            free(catalog_msg);
+            catalog_msg = NULL;
+        }
+        catalog_msg_len = 0;
+        catalog_msg = malloc(CATALOG_MESSAGE_MAX);
+        if (catalog_msg == NULL) {
+            catalog_dropped++;
+            ESP_LOGE(TAG_SOCK, "No memory to receive a %d byte message", data->payload_len);
+            return;
+        }
+    } else if (catalog_msg == NULL || (data->op_code != 0x01 && data->op_code != 0x00)) {
+        // Part of a message not collected, or a control frame in between
+        return;
+    }
+
+    if (catalog_msg_len + data->data_len > CATALOG_MESSAGE_MAX) {
+        catalog_dropped++;
+        ESP_LOGE(TAG_SOCK, "Text message longer than %d bytes dropped", CATALOG_MESSAGE_MAX);
+        free(catalog_msg);
+        catalog_msg = NULL;
+        return;
+    }
+    memcpy(catalog_msg + catalog_msg_len, data->data_ptr, data->data_len);
+    catalog_msg_len += data->data_len;
+
+    if (last) {
+        catalog_post(catalog_msg, catalog_msg_len);
+        free(catalog_msg);
+        catalog_msg = NULL;
+    }
+}
+
 // WebSocket event handler
 static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -607,72 +756,35 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
     switch (event_id) {
         case WEBSOCKET_EVENT_CONNECTED:
             ESP_LOGI(TAG_SOCK, "WebSocket Connected");
+            // The server may have missed changes while disconnected
+            telemetry_resync();
+            notify_state_change();
             break;
         case WEBSOCKET_EVENT_DISCONNECTED:
             ESP_LOGE(TAG_SOCK, "WebSocket Disconnected");
             break;
-        case WEBSOCKET_EVENT_DATA:
+        case WEBSOCKET_EVENT_DATA: {
             ESP_LOGI(TAG_SOCK, "Received data length: %d", data->data_len);
             ESP_LOGI(TAG_SOCK, "Received data: %.*s", data->data_len, (char*)data->data_ptr);
+
+            // Acks of the frames sent, opcode 0x01 text and 0x02 binary
+            uint16_t seq;
+            if ((data->op_code == 0x01 && callframe_ack_json(data->data_ptr, data->data_len, &seq) == 0) ||
+                (data->op_code == 0x02 && callframe_ack_bin((const uint8_t *)data->data_ptr, data->data_len, &seq) == 0)) {
+                telemetry_ack(seq);
+                break;
+            }
+
+            // Catalog updates, handed over without waiting for the display task
+            catalog_receive(data);
             break;
+        }
         case WEBSOCKET_EVENT_ERROR:
             ESP_LOGE(TAG_SOCK, "WebSocket Error");
             break;
     }
 }
 
-// Task to send data periodically
-void send_data_task(esp_websocket_client_handle_t client)
-{    
-    if (esp_websocket_client_is_connected(client)) {
-        // Check inputs
-        bool call1 = REG_READ(gpio_in1_reg)&(1 << (CALL1-32));
-        bool call2 = REG_READ(gpio_in1_reg)&(1 << (CALL2-32));
-        bool call3 = REG_READ(gpio_in1_reg)&(1 << (CALL3-32));
-
-        // Create a JSON object
-        cJSON *json = cJSON_CreateObject();
-        cJSON_AddNumberToObject(json, "consoleid", CONSOLE_ID); // Define ConsoleID
-        cJSON_AddStringToObject(json, "department", department.deptid ? department.deptid : "Undefined");
-        cJSON_AddStringToObject(json, "call1", call1 ? (calls[0].status ? calls[0].status : "Undefined") : "");
-        cJSON_AddStringToObject(json, "call2", call2 ? (calls[1].status ? calls[1].status : "Undefined") : "");
-        cJSON_AddStringToObject(json, "call3", call3 ? (calls[2].status ? calls[2].status : "Undefined") : "");
-        cJSON_AddStringToObject(json, "oldcall", "");
-
-        // Convert JSON object to string
-        char *json_string = cJSON_PrintUnformatted(json);
-
-        // Send JSON string
-        esp_websocket_client_send_text(client, json_string, strlen(json_string), portMAX_DELAY);
-        ESP_LOGI(TAG_SOCK, "Sent data: %s", json_string);
-
-        // Free JSON string and object
-        free(json_string);
-        cJSON_Delete(json);
-
-        if (call1) {
-            *gpio_out_w1ts_reg |= (1 << IND1);
-            ESP_LOGI(TAG_CODE, "Call1");
-        } 
-
-        if (call2) {
-            *gpio_out_w1ts_reg |= (1 << IND2);
-            ESP_LOGI(TAG_CODE, "Call2");
-        }
-
-        if (call3) {
-            *gpio_out_w1ts_reg |= (1 << IND3);
-            ESP_LOGI(TAG_CODE, "Call3");
-        }
-
-        if (!call1 & !call2 & !call3) {
-            *gpio_out_w1tc_reg |= (1 << IND1) | (1 << IND2) | (1 << IND3);
-        }
-    } else {
-        ESP_LOGW(TAG_SOCK, "WebSocket client is not connected");
-    }
-}
-
 // Function to initialize and start WebSocket client
 void websocket_app_start(void)
 {
@@ -685,6 +797,122 @@ void websocket_app_start(void)
     // Register the WebSocket event handler
     esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)client);
     esp_websocket_client_start(client);
+    telemetry_set_client(client);
+}
+
+
+
+// -----------------------------------------------------------
+//    Catalog updates from the server
+// -----------------------------------------------------------
+//
+// Parsed by the websocket handler, applied by the display task
+// which owns callRecords[] and deptRecords[] (see catalog.h).
+//
+// -----------------------------------------------------------
+
+static const char *TAG_CATALOG = "Catalog";
+
+int findCallRecord(const char *desc) {
+    for (int i = 0; i < callRecordCount; i++) {
+        if (callRecords[i].mancalldesc != NULL && strcmp(callRecords[i].mancalldesc, desc) == 0) return i;
+    }
+    return -1;
+}
+
+int findDeptRecord(const char *id) {
+    for (int i = 0; i < deptRecordCount; i++) {
+        if (deptRecords[i].deptid != NULL && strcmp(deptRecords[i].deptid, id) == 0) return i;
+    }
+    return -1;
+}
+
+void applyCallUpdate(const catalog_cmd_t *cmd) {
+    int index = findCallRecord(cmd->key);
+
+    if (cmd->op == CATALOG_REMOVE) {
+        if (index < 0) return;
+
+        free(callRecords[index].status);
+        free(callRecords[index].mancalldesc);
+        free(callRecords[index].mancallto);
+        memmove(&callRecords[index], &callRecords[index + 1], (callRecordCount - index - 1) * sizeof(struct Callrecord));
+        callRecordCount--;
+        callRecords[callRecordCount] = (struct Callrecord) {NULL, NULL, NULL};
+        ESP_LOGI(TAG_CATALOG, "Call removed: %s", cmd->key);
+        return;
+    }
+
+    if (index < 0) {
+        if (callRecordCount == MAX_CALL_RECORDS) {
+            ESP_LOGE(TAG_CATALOG, "No room for call %s", cmd->key);
+            return;
+        }
+        index = callRecordCount++;
+    }
+    setCallrecord(&callRecords[index], cmd->status, cmd->key, cmd->name);
+    ESP_LOGI(TAG_CATALOG, "Call set: %s", cmd->key);
+
+    // Calls already chosen on this console follow the catalog
+    bool chosen = false;
+    for (int i = 0; i < 3; i++) {
+        if (calls[i].mancalldesc != NULL && strcmp(calls[i].mancalldesc, cmd->key) == 0) {
+            setCallrecord(&calls[i], cmd->status, cmd->key, cmd->name);
+            chosen = true;
+        }
+    }
+    if (chosen) {
+        saveCalls();
+        notify_state_change();
+    }
+}
+
+void applyDeptUpdate(const catalog_cmd_t *cmd) {
+    int index = findDeptRecord(cmd->key);
+
+    if (cmd->op == CATALOG_REMOVE) {
+        if (index < 0) return;
+
+        free(deptRecords[index].deptname);
+        free(deptRecords[index].deptid);
+        memmove(&deptRecords[index], &deptRecords[index + 1], (deptRecordCount - index - 1) * sizeof(struct Deptrecord));
+        deptRecordCount--;
+        deptRecords[deptRecordCount] = (struct Deptrecord) {NULL, NULL};
+        ESP_LOGI(TAG_CATALOG, "Department removed: %s", cmd->key);
+        return;
+    }
+
+    if (index < 0) {
+        if (deptRecordCount == MAX_DEPT_RECORDS) {
+            ESP_LOGE(TAG_CATALOG, "No room for department %s", cmd->key);
+            return;
+        }
+        index = deptRecordCount++;
+    }
+    setDeptrecord(&deptRecords[index], cmd->name, cmd->key);
+    ESP_LOGI(TAG_CATALOG, "Department set: %s", cmd->key);
+
+    // Renaming the department of this console
+    if (department.deptid != NULL && strcmp(department.deptid, cmd->key) == 0) {
+        setDeptrecord(&department, cmd->name, cmd->key);
+        saveDepts();
+    }
+}
+
+// Applies the catalog updates received so far, returns true if there were any
+bool applyCatalogUpdates() {
+    catalog_batch_t *batch;
+    bool changed = false;
+
+    while (xQueueReceive(catalog_queue, &batch, 0) == pdTRUE) {
+        for (int i = 0; i < batch->count; i++) {
+            if (batch->cmds[i].kind == CATALOG_CALLS) applyCallUpdate(&batch->cmds[i]);
+            else applyDeptUpdate(&batch->cmds[i]);
+        }
+        free(batch);
+        changed = true;
+    }
+    return changed;
 }
 
 
@@ -858,10 +1086,55 @@ int default_spacing = 2;
 int refresh_rate    = 500;
 int highlight_padding = 3;
 
+// Lines as they are on the panel, a line is only sent again when its text,
+// highlight, position or font changes
+#define DISP_LINES    8
+#define DISP_TEXT_LEN 64        // Longer lines are always redrawn
+
+typedef struct {
+    bool used;                  // Something is drawn on this line
+    bool drawn;                 // Written since disp_begin()
+    bool highlight;
+    int  font;
+    int  x;
+    int  y;
+    char text[DISP_TEXT_LEN];
+} disp_line_t;
+
+static disp_line_t disp_lines[DISP_LINES];
+static uint32_t disp_repaints = 0;      // Lines actually sent to the panel
+
+// Clears the area of a line
+static void disp_clear_line(const disp_line_t *l) {
+    TFT_fillRect(l->x-highlight_padding, l->y-highlight_padding, tft_width-2*(l->x-highlight_padding), TFT_getfontheight()+2*highlight_padding, TFT_BLACK);
+}
+
 // Function to display
 void disp_write(const char *distring, int x, int line, bool highlight) {
     int y = 10*(line-1)*spacing+25;
+    if (distring == NULL) distring = "";
+
+    disp_line_t *l = (line >= 1 && line <= DISP_LINES) ? &disp_lines[line-1] : NULL;
+    if (l != NULL) {
+        l->drawn = true;
+        if (l->used && l->highlight == highlight && l->font == DEFAULT_FONT && l->x == x && l->y == y &&
+            strlen(distring) < DISP_TEXT_LEN && strcmp(l->text, distring) == 0) {
+            return;     // Already on the panel
+        }
+    }
+
     TFT_setFont(DEFAULT_FONT, NULL);
+    if (l != NULL && l->used && (l->x != x || l->y != y)) disp_clear_line(l);
+    disp_repaints++;
+
+    if (l != NULL) {
+        l->used = true;
+        l->highlight = highlight;
+        l->font = DEFAULT_FONT;
+        l->x = x;
+        l->y = y;
+        strlcpy(l->text, distring, sizeof(l->text));
+    }
 
     if (!highlight) {
         // -- -- Prints onto display -- --
@@ -883,6 +1156,28 @@ void disp_write(const char *distring, int x, int line, bool highlight) {
 // Function to clear screen
 void disp_cls() {
     TFT_fillScreen(TFT_BLACK);
+    memset(disp_lines, 0, sizeof(disp_lines));
+    TFT_flush();
+}
+
+// Starts redrawing a screen, its lines are written with disp_write() and
+// only the ones that changed are sent to the panel
+void disp_begin() {
+    for (int i = 0; i < DISP_LINES; i++) disp_lines[i].drawn = false;
+}
+
+// Ends a redraw, clears the lines left over from the previous screen
+void disp_end() {
+    for (int i = 0; i < DISP_LINES; i++) {
+        disp_line_t *l = &disp_lines[i];
+        if (l->used && !l->drawn) {
+            TFT_setFont(l->font, NULL);
+            disp_clear_line(l);
+            l->used = false;
+            disp_repaints++;
+        }
+    }
+    TFT_flush();                         // No-op unless drawing into the framebuffer
 }
 
 // Open animation
@@ -893,12 +1188,44 @@ void disp_start() {
     ESP_LOGI(TAG_DISP,"Start - Display Started");
 }
 
+// Scrolling list, shows LIST_ROWS lines of any record array. Only the
+// visible window is drawn and the window follows the selection, moving by
+// one row when the selection leaves it. Lines that did not change are not
+// sent again (see disp_write()), so moving the selection inside the window
+// repaints two lines.
+#define LIST_ROWS 4
+
+typedef const char *(*list_text_t)(int index);
+
+typedef struct {
+    int top;                    // Index of the first visible item
+} list_view_t;
+
+// Draws 'count' items with 'selected' (0 based) highlighted, 'text' returns
+// the text of an item
+void list_draw(list_view_t *list, int count, int selected, list_text_t text) {
+    if (selected < list->top) list->top = selected;
+    else if (selected >= list->top + LIST_ROWS) list->top = selected - LIST_ROWS + 1;
+
+    // Keep the window full when the list got shorter
+    if (list->top > count - LIST_ROWS) list->top = count - LIST_ROWS;
+    if (list->top < 0) list->top = 0;
+
+    for (int row = 0; row < LIST_ROWS && list->top + row < count; row++) {
+        int index = list->top + row;
+        disp_write(text(index), 5, row + 1, index == selected);
+    }
+}
+
 
 // --------------------------------------------------------
 //    Functions for Menu 
 // --------------------------------------------------------
 // 
-// The main menu is structured as below:
+// The menu is a state machine run by the display task. Each
+// button press or tick is one step which updates the state,
+// redraws the screen if needed and returns, nothing waits in
+// a menu. The menu is structured as below:
 // 
 // Main Menu
 //   |___ Settings
@@ -910,112 +1237,43 @@ void disp_start() {
 // 
 // -------------------------------------------------------- 
 
-// Checks for the buttons pressed
-int checkButtonPress() {
-    if (REG_READ(gpio_in_reg) & (1 << UP)) {
-        return 1;
-    } else if (REG_READ(gpio_in_reg) & (1 << SELOK)) {
-        return 2;
-    } else if (REG_READ(gpio_in_reg) & (1 << DOWN)) {
-        return 3;
-    } else {
-        return 0;
+// Waits up to 'wait' for a button, returns 1 (up), 2 (select), 3 (down) or
+// 0 if none was pressed. Events are queued by the debouncer (buttons.h) so
+// none is missed while the display is busy. Up and down repeat while held.
+int waitButtonPress(TickType_t wait) {
+    button_event_t evt;
+
+    while (xQueueReceive(button_queue, &evt, wait) == pdTRUE) {
+        if (evt.type == BUTTON_PRESS ||
+            (evt.type == BUTTON_REPEAT && evt.button != BUTTON_SELOK)) {
+            ESP_LOGD(TAG_DISP, "Button %d handled %lld us after it was detected", evt.button, esp_timer_get_time() - evt.timestamp);
+            return evt.button;
+        }
+        wait = 0;       // Releases and long presses are not used, only what is queued behind them
     }
+    return 0;
+}
+
+static list_view_t call_list;
+static list_view_t dept_list;
+
+static const char *call_list_text(int index) {
+    return callRecords[index].mancalldesc;
+}
+
+static const char *dept_list_text(int index) {
+    return deptRecords[index].deptname;
 }
 
 // Displaying Menu for choosing calls
 void showChooseCalls(int menu_item) {
-    int button = 0;
     if (callRecordCount == 0) {
         disp_write("No calls set", 5, 1, false);
         disp_write("Please set on mgmt console", 5, 2, false);
         disp_write("Go back", 5, 3, true);
 
     } else {
-        if ((callRecordCount%4 == 3)&&(menu_item>callRecordCount-3)) {
-            if ((menu_item-(callRecordCount-3))%3 == 1) {
-                disp_write(callRecords[menu_item].mancalldesc, 5, 2, false);
-                disp_write(callRecords[menu_item+1].mancalldesc, 5, 3, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 1, true);
-            } else if ((menu_item-(callRecordCount-3))%3 == 2) {
-                disp_write(callRecords[menu_item-2].mancalldesc, 5, 1, false);
-                disp_write(callRecords[menu_item].mancalldesc, 5, 3, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 2, true);
-            } else {
-                disp_write(callRecords[menu_item-3].mancalldesc, 5, 1, false);
-                disp_write(callRecords[menu_item-2].mancalldesc, 5, 2, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 3, true);
-            }
-        } else if ((callRecordCount%4 == 2)&&(menu_item>callRecordCount-2)) {
-            if ((menu_item - (callRecordCount-2))%2 == 1) {
-                disp_write(callRecords[menu_item].mancalldesc, 5, 2, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 1, true);
-            } else {
-                disp_write(callRecords[menu_item-2].mancalldesc, 5, 1, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 2, true);
-            }
-        } else if ((callRecordCount%4 == 1)&&(menu_item>callRecordCount-1)) {
-            disp_write(callRecords[menu_item-1].mancalldesc, 5, 1, true);
-        } else {
-            if (menu_item%4 == 1) {
-                disp_write(callRecords[menu_item].mancalldesc, 5, 2, false);
-                disp_write(callRecords[menu_item+1].mancalldesc, 5, 3, false);
-                disp_write(callRecords[menu_item+2].mancalldesc, 5, 4, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 1, true);
-            } else if (menu_item%4 == 2) {
-                disp_write(callRecords[menu_item-2].mancalldesc, 5, 1, false);
-                disp_write(callRecords[menu_item].mancalldesc, 5, 3, false);
-                disp_write(callRecords[menu_item+1].mancalldesc, 5, 4, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 2, true);
-            } else if (menu_item%4 == 3) {
-                disp_write(callRecords[menu_item-3].mancalldesc, 5, 1, false);
-                disp_write(callRecords[menu_item-2].mancalldesc, 5, 2, false);
-                disp_write(callRecords[menu_item].mancalldesc, 5, 4, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 3, true);
-            } else {
-                disp_write(callRecords[menu_item-4].mancalldesc, 5, 1, false);
-                disp_write(callRecords[menu_item-3].mancalldesc, 5, 2, false);
-                disp_write(callRecords[menu_item-2].mancalldesc, 5, 3, false);
-                disp_write(callRecords[menu_item-1].mancalldesc, 5, 4, true);
-            }
-        }
-    }
-}
-
-// Menu for choosing calls
-void chooseCalls(int callIndex) {
-    //fetchCallRecords();
-     
-    int menu_item = 1;
-    int button = 0;
-    showChooseCalls(menu_item);
-
-    while (true) {
-        vTaskDelay(pdMS_TO_TICKS(500));
-        button = checkButtonPress();
-
-        if (button==1) {
-            menu_item = (menu_item == 1) ? callRecordCount : menu_item-1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showChooseCalls(menu_item);
-
-        } else if (button==3) {           // Decrement
-            menu_item = (menu_item == callRecordCount) ? 1 : menu_item+1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showChooseCalls(menu_item);
-
-        } else if (button==2) {
-            if (callRecordCount!=0) {
-                setCallrecord(&calls[callIndex], callRecords[menu_item-1].status, callRecords[menu_item-1].mancalldesc, callRecords[menu_item-1].mancallto);
-                saveCalls();
-            }
-            ESP_LOGI(TAG_CODE, "Call chosen");
-            disp_cls();
-            vTaskDelay(pdMS_TO_TICKS(500));
-            break;
-        }
+        list_draw(&call_list, callRecordCount, menu_item - 1, call_list_text);
     }
 }
 
@@ -1055,147 +1313,15 @@ void showSetCalls(int menu_item) {
     }    
 }
 
-// Menu for setting calls
-void setCalls() {
-    int menu_item = 1;
-    int button = 0;
-    showSetCalls(menu_item);
-
-    while (true) {
-        button = checkButtonPress();
-
-        if (button==1) {
-            menu_item = (menu_item==1) ? 4 : menu_item-1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showSetCalls(menu_item);
-
-        } else if (button==3) {           // Decrement
-            menu_item = (menu_item==4) ? 1 : menu_item+1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showSetCalls(menu_item);
-
-        } else if (button==2) {
-            vTaskDelay(pdMS_TO_TICKS(500));
-            if (menu_item==1) {
-                disp_cls();
-                chooseCalls(0);
-                showSetCalls(menu_item);
-                vTaskDelay(pdMS_TO_TICKS(500));
-
-            } else if (menu_item==2) {
-                disp_cls();
-                chooseCalls(1);
-                showSetCalls(menu_item);
-                vTaskDelay(pdMS_TO_TICKS(500));
-
-            } else if (menu_item==3) {
-                disp_cls();
-                chooseCalls(2);
-                showSetCalls(menu_item);
-                vTaskDelay(pdMS_TO_TICKS(500));
-
-            } else {
-                disp_cls();
-                vTaskDelay(pdMS_TO_TICKS(500));
-                break;
-            }
-        }
-    }
-    ESP_LOGI(TAG_DISP, "Exiting SetCalls()");
-}
-
 // Displaying menu choosing the department
 void showSetDepartment(int menu_item) {
-    int button = 0;
     if (deptRecordCount == 0) {
         disp_write("No departments set", 5, 1, false);
         disp_write("Please set on mgmt console", 5, 2, false);
         disp_write("Go back", 5, 3, true);
 
     } else {
-        if ((deptRecordCount%4 == 3)&&(menu_item>deptRecordCount-3)) {
-            if ((menu_item-(deptRecordCount-3))%3 == 1) {
-                disp_write(deptRecords[menu_item].deptname, 5, 2, false);
-                disp_write(deptRecords[menu_item+1].deptname, 5, 3, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 1, true);
-            } else if ((menu_item-(deptRecordCount-3))%3 == 2) {
-                disp_write(deptRecords[menu_item-2].deptname, 5, 1, false);
-                disp_write(deptRecords[menu_item].deptname, 5, 3, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 2, true);
-            } else {
-                disp_write(deptRecords[menu_item-3].deptname, 5, 1, false);
-                disp_write(deptRecords[menu_item-2].deptname, 5, 2, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 3, true);
-            }
-        } else if ((deptRecordCount%4 == 2)&&(menu_item>deptRecordCount-2)) {
-            if ((menu_item - (deptRecordCount-2))%2 == 1) {
-                disp_write(deptRecords[menu_item].deptname, 5, 2, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 1, true);
-            } else {
-                disp_write(deptRecords[menu_item-2].deptname, 5, 1, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 2, true);
-            }
-        } else if ((deptRecordCount%4 == 1)&&(menu_item>deptRecordCount-1)) {
-            disp_write(deptRecords[menu_item-1].deptname, 5, 1, true);
-        } else {
-            if (menu_item%4 == 1) {
-                disp_write(deptRecords[menu_item].deptname, 5, 2, false);
-                disp_write(deptRecords[menu_item+1].deptname, 5, 3, false);
-                disp_write(deptRecords[menu_item+2].deptname, 5, 4, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 1, true);
-            } else if (menu_item%4 == 2) {
-                disp_write(deptRecords[menu_item-2].deptname, 5, 1, false);
-                disp_write(deptRecords[menu_item].deptname, 5, 3, false);
-                disp_write(deptRecords[menu_item+1].deptname, 5, 4, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 2, true);
-            } else if (menu_item%4 == 3) {
-                disp_write(deptRecords[menu_item-3].deptname, 5, 1, false);
-                disp_write(deptRecords[menu_item-2].deptname, 5, 2, false);
-                disp_write(deptRecords[menu_item].deptname, 5, 4, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 3, true);
-            } else {
-                disp_write(deptRecords[menu_item-4].deptname, 5, 1, false);
-                disp_write(deptRecords[menu_item-3].deptname, 5, 2, false);
-                disp_write(deptRecords[menu_item-2].deptname, 5, 3, false);
-                disp_write(deptRecords[menu_item-1].deptname, 5, 4, true);
-            }
-        }
-    }
-}
-
-// Menu choosing the department
-void setDepartment() {
-    //fetchDeptRecords();
-
-    int menu_item = 1;
-    int button = 0;
-    showSetDepartment(menu_item);
-
-    while (true) {
-        button = checkButtonPress();
-
-        if (button==1) {
-            menu_item = (menu_item <= 0) ? 1 : menu_item-1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showSetDepartment(menu_item);
-
-        } else if (button==3) {           // Decrement
-            menu_item = (menu_item >= deptRecordCount) ? deptRecordCount : menu_item+1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showSetDepartment(menu_item);
-
-        } else if (button==2) {
-            if (deptRecordCount!=0) {
-                setDeptrecord(&department, deptRecords[menu_item-1].deptname, deptRecords[menu_item-1].deptid);
-                saveDepts();
-            }
-            vTaskDelay(pdMS_TO_TICKS(500));
-            break;
-        }
+        list_draw(&dept_list, deptRecordCount, menu_item - 1, dept_list_text);
     }
 }
 
@@ -1243,56 +1369,8 @@ void showSettings(int menu_item) {
     }
 }
 
-// Settings menu
-void settings() {
-    int menu_item = 1;
-    int button = 0;
-    showSettings(menu_item);           // Increment
-
-    while (true) {        
-        button = checkButtonPress();
-
-        if (button==1) {
-            menu_item = (menu_item==1) ? 5 : menu_item-1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showSettings(menu_item);           // Increment
-
-        } else if (button==3) {           // Decrement
-            menu_item = (menu_item==5) ? 1 : menu_item+1;
-            vTaskDelay(pdMS_TO_TICKS(500));
-            disp_cls();
-            showSettings(menu_item);           // Increment
-
-        } else if (button==2) {           // Select
-            vTaskDelay(pdMS_TO_TICKS(500));
-            if (menu_item==1) {
-                
-            } else if (menu_item==2) {
-                disp_cls();
-                setCalls();
-                showSettings(menu_item);
-            } else if (menu_item==3) {
-                disp_cls();
-                setDepartment();
-                showSettings(menu_item);
-            } else if (menu_item==4) {
-                disp_cls();
-                resetAll();
-                vTaskDelay(pdMS_TO_TICKS(500));
-                showSettings(menu_item);
-            } else {
-                disp_cls();
-                break;
-            }
-        }
-    }
-
-    ESP_LOGI(TAG_DISP, "Exiting settings()");
-}
-
 // Main menu
-void showMainMenu(){      // Main Menu
+void showMainMenu() {      // Main Menu
     spacing = default_spacing; 
     char display_text[50];
 
@@ -1319,13 +1397,346 @@ void showMainMenu(){      // Main Menu
 
         disp_write("Settings", 5, 4,true);
     }
+}
 
-    vTaskDelay(pdMS_TO_TICKS(500));
 
-    if (checkButtonPress()==2) {
-        disp_cls();
-        settings();           // Goto the settings menu
-        vTaskDelay(pdMS_TO_TICKS(500));
+// -------------- Menu state machine --------------
+
+#define MENU_TIMEOUT_MS 7500    // Main menu on time without a press
+
+typedef enum {
+    MENU_OFF,                   // Display off, select wakes it
+    MENU_MAIN,
+    MENU_SETTINGS,
+    MENU_SET_CALLS,
+    MENU_CHOOSE_CALL,
+    MENU_SET_DEPARTMENT,
+    MENU_SCREENS
+} menu_screen_t;
+
+typedef struct {
+    uint32_t steps;             // Calls to menu_step()
+    uint32_t redraws;           // Steps which redrew the screen
+    uint32_t lines;             // Lines sent to the panel by those redraws
+    uint64_t busy_us;           // Time spent in the steps
+    uint32_t max_us;            // Longest step
+} menu_stats_t;
+
+static menu_screen_t menu_screen = MENU_OFF;
+static int menu_items[MENU_SCREENS];    // Highlighted item of each screen, from 1
+static int menu_call = 0;               // Call chosen in MENU_CHOOSE_CALL
+static bool menu_dirty = false;         // Screen to be redrawn
+static int64_t menu_input_time = 0;     // Last press
+static int64_t menu_refresh_time = 0;   // Last redraw of the main menu
+static menu_stats_t menu_stats;
+
+// Items of a screen, 0 for an empty list
+static int menu_count(menu_screen_t screen) {
+    switch (screen) {
+        case MENU_SETTINGS:       return 5;
+        case MENU_SET_CALLS:      return 4;
+        case MENU_CHOOSE_CALL:    return callRecordCount;
+        case MENU_SET_DEPARTMENT: return deptRecordCount;
+        default:                  return 1;
+    }
+}
+
+// Goes to 'screen', highlighting its first item or the one left there
+static void menu_enter(menu_screen_t screen, bool first) {
+    if (first) menu_items[screen] = 1;
+    menu_screen = screen;
+    menu_dirty = true;
+}
+
+// Moves the highlight one item up (-1) or down (1)
+static void menu_move(int step) {
+    int count = menu_count(menu_screen);
+    int item = menu_items[menu_screen] + step;
+
+    if (count <= 1) return;
+    if (menu_screen == MENU_SET_DEPARTMENT) {
+        // Stops at both ends
+        if (item < 1 || item > count) return;
+    } else {
+        if (item < 1) item = count;
+        if (item > count) item = 1;
+    }
+    menu_items[menu_screen] = item;
+    menu_dirty = true;
+}
+
+static void menu_select(void) {
+    int item = menu_items[menu_screen];
+
+    switch (menu_screen) {
+        case MENU_OFF:
+            *gpio_out_w1ts_reg |= (1 << BKLT);
+            menu_enter(MENU_MAIN, true);
+            break;
+
+        case MENU_MAIN:
+            menu_enter(MENU_SETTINGS, true);
+            break;
+
+        case MENU_SETTINGS:
+            if (item == 2) menu_enter(MENU_SET_CALLS, true);
+            else if (item == 3) menu_enter(MENU_SET_DEPARTMENT, true);
+            else if (item == 4) {
+                resetAll();
+                menu_dirty = true;
+            } else if (item == 5) {
+                ESP_LOGI(TAG_DISP, "Exiting settings");
+                menu_enter(MENU_MAIN, false);
+            }
+            break;
+
+        case MENU_SET_CALLS:
+            if (item <= 3) {
+                menu_call = item - 1;
+                menu_enter(MENU_CHOOSE_CALL, true);
+            } else {
+                menu_enter(MENU_SETTINGS, false);
+            }
+            break;
+
+        case MENU_CHOOSE_CALL:
+            if (callRecordCount != 0) {
+                setCallrecord(&calls[menu_call], callRecords[item-1].status, callRecords[item-1].mancalldesc, callRecords[item-1].mancallto);
+                saveCalls();
+                notify_state_change();
+                ESP_LOGI(TAG_CODE, "Call chosen");
+            }
+            menu_enter(MENU_SET_CALLS, false);
+            break;
+
+        case MENU_SET_DEPARTMENT:
+            if (deptRecordCount != 0) {
+                setDeptrecord(&department, deptRecords[item-1].deptname, deptRecords[item-1].deptid);
+                saveDepts();
+                notify_state_change();
+            }
+            menu_enter(MENU_SETTINGS, false);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void menu_draw(void) {
+    int count = menu_count(menu_screen);
+    int *item = &menu_items[menu_screen];
+
+    // Lists may have shrunk with a catalog update
+    if (*item > count) *item = (count > 0) ? count : 1;
+
+    uint32_t repaints = disp_repaints;
+
+    disp_begin();
+    switch (menu_screen) {
+        case MENU_MAIN:           showMainMenu(); break;
+        case MENU_SETTINGS:       showSettings(*item); break;
+        case MENU_SET_CALLS:      showSetCalls(*item); break;
+        case MENU_CHOOSE_CALL:    showChooseCalls(*item); break;
+        case MENU_SET_DEPARTMENT: showSetDepartment(*item); break;
+        default:                  break;
+    }
+    disp_end();
+
+    menu_stats.lines += disp_repaints - repaints;
+}
+
+// Reports the menu steps and the telemetry acks when the display goes off.
+// The telemetry counters are copied while the network task may be updating
+// them, a report can be one event behind.
+static void menu_log_stats(void) {
+    static const uint32_t bounds[CALLFRAME_HIST_BUCKETS - 1] = CALLFRAME_HIST_BOUNDS;
+    telemetry_stats_t tel;
+    char hist[CALLFRAME_HIST_BUCKETS * 20];
+    int len = 0;
+
+    ESP_LOGI(TAG_DISP, "Display off, %lu menu steps, %lu redraws, %lu lines sent, %llu us average, %lu us max",
+             (unsigned long)menu_stats.steps, (unsigned long)menu_stats.redraws, (unsigned long)menu_stats.lines,
+             menu_stats.steps ? menu_stats.busy_us / menu_stats.steps : 0, (unsigned long)menu_stats.max_us);
+
+    telemetry_get_stats(&tel);
+    for (int i = 0; i < CALLFRAME_HIST_BUCKETS; i++) {
+        if (i < CALLFRAME_HIST_BUCKETS - 1) {
+            len += snprintf(hist + len, sizeof(hist) - len, " <=%lu:%lu", (unsigned long)bounds[i], (unsigned long)tel.acks.hist[i]);
+        } else {
+            len += snprintf(hist + len, sizeof(hist) - len, " more:%lu", (unsigned long)tel.acks.hist[i]);
+        }
+    }
+    ESP_LOGI(TAG_DISP, "Acks, %lu acked, %lu retransmits, %lu expired, press to ack ms%s",
+             (unsigned long)tel.acks.acked, (unsigned long)tel.acks.retransmits, (unsigned long)tel.acks.expired, hist);
+}
+
+// One step of the menu: 'button' pressed (1 up, 2 select, 3 down) or 0 on a
+// tick. 'changed' is set when the records shown may have changed.
+void menu_step(int button, bool changed, int64_t now) {
+    if (button != 0) menu_input_time = now;
+
+    if (button == 1) menu_move(-1);
+    else if (button == 3) menu_move(1);
+    else if (button == 2) menu_select();
+
+    if (menu_screen == MENU_OFF) return;
+    if (changed) menu_dirty = true;
+
+    if (menu_screen == MENU_MAIN && now - menu_input_time >= MENU_TIMEOUT_MS * 1000LL) {
+        *gpio_out_w1tc_reg |= (1 << BKLT);
+        menu_screen = MENU_OFF;
+        menu_dirty = false;
+
+        menu_log_stats();
+        return;
+    }
+
+    if (menu_dirty) {
+        menu_dirty = false;
+        menu_stats.redraws++;
+        menu_draw();
+        menu_refresh_time = now;
+
+    } else if (menu_screen == MENU_MAIN && now - menu_refresh_time >= refresh_rate * 1000LL) {
+        // The calls shown may have changed, only changed lines are sent
+        menu_draw();
+        menu_refresh_time = now;
+    }
+}
+
+// Time until the menu needs a tick, if no button is pressed
+TickType_t menu_wait(void) {
+    return pdMS_TO_TICKS((menu_screen == MENU_MAIN) ? refresh_rate : 1000);
+}
+
+
+// --------------------------------------------------------
+//    Tasks
+// --------------------------------------------------------
+//
+// input_task    Call edges queued by the ISR. Never waits on the
+//               network or the display.
+// network_task  Telemetry, the only task sending on the websocket.
+// ui_task       Menu state machine and display rendering, one
+//               step per button press or tick.
+//
+// Tasks talk through three queues, none of them waited on by
+// the sender, so a slow redraw or a blocked websocket send does
+// not delay capture:
+//   net_queue      States for network_task, posted by input_task,
+//                  and by any task changing the department or
+//                  calls (notify_state_change()).
+//   button_queue   Presses for ui_task, debounced by a timer ISR.
+//   catalog_queue  Catalog batches for ui_task, parsed in the
+//                  websocket event handler. The handler then posts
+//                  a BUTTON_WAKE to button_queue so ui_task applies
+//                  them at once instead of on its next tick.
+// The call and department records are shared under state_lock.
+//
+// --------------------------------------------------------
+
+// Drives the indicator of a call
+void set_indicator(uint8_t call, bool on) {
+    const int indicators[CALL_COUNT] = {IND1, IND2, IND3};
+
+    if (on) *gpio_out_w1ts_reg |= (1 << indicators[call]);
+    else    *gpio_out_w1tc_reg |= (1 << indicators[call]);
+}
+
+void input_task(void *arg)
+{
+    call_event_t evt;
+    uint32_t dropped = 0;
+    uint32_t buttons_reported = 0;
+    uint32_t net_reported = 0;
+
+    while (true) {
+        // Woken by the ISR as soon as an edge is queued
+        ulTaskNotifyTake(pdTRUE, net_overflow ? pdMS_TO_TICKS(NET_RETRY_MS) : portMAX_DELAY);
+
+        while (callcapture_pop(&evt)) {
+            if (evt.pressed) call_mask |= (1 << evt.call);
+            else call_mask &= ~(1 << evt.call);
+
+            set_indicator(evt.call, evt.pressed);
+
+            // Posted per edge so a short press is not merged away
+            post_state(evt.timestamp);
+
+            ESP_LOGI(TAG_CODE, "Call%d %s, %lld us after the edge", evt.call+1,
+                     evt.pressed ? "pressed" : "released", esp_timer_get_time() - evt.timestamp);
+        }
+
+        // Network task behind, the latest state is posted once there is room
+        if (net_overflow) post_state(esp_timer_get_time());
+
+        if (callcapture_dropped() != dropped) {
+            dropped = callcapture_dropped();
+            ESP_LOGW(TAG_CODE, "%lu call edges dropped", (unsigned long)dropped);
+        }
+        if (buttons_dropped() != buttons_reported) {
+            buttons_reported = buttons_dropped();
+            ESP_LOGW(TAG_CODE, "%lu button events dropped", (unsigned long)buttons_reported);
+        }
+        if (net_dropped != net_reported) {
+            net_reported = net_dropped;
+            ESP_LOGW(TAG_CODE, "Network queue full %lu times", (unsigned long)net_reported);
+        }
+    }
+}
+
+// Offers a state to telemetry as the current one
+static void offer_state(const journal_entry_t *state)
+{
+    callframe_t frame;
+
+    journal_callframe(state, CONSOLE_ID, state->timestamp, &frame);
+    frame.oldcall = CALLFRAME_LIVE;
+    telemetry_offer(&frame, state->timestamp);
+}
+
+void network_task(void *arg)
+{
+    journal_entry_t state;
+    journal_entry_t last;
+    bool have_state = false;
+
+    while (true) {
+        // Sleeps until a state arrives, or the batch or heartbeat is due
+        TickType_t wait = have_state ? pdMS_TO_TICKS(telemetry_wait_ms()) : portMAX_DELAY;
+
+        if (xQueueReceive(net_queue, &state, wait) == pdTRUE) {
+            do {
+                offer_state(&state);
+                last = state;
+            } while (xQueueReceive(net_queue, &state, 0) == pdTRUE);
+            have_state = true;
+        } else if (have_state) {
+            // Nothing changed, the heartbeat repeats the last state
+            last.timestamp = esp_timer_get_time();
+            offer_state(&last);
+        }
+
+        telemetry_poll();
+    }
+}
+
+void ui_task(void *arg)
+{
+    while(true) {
+        // Wakes at once on a press, otherwise when the menu needs a tick
+        int button = waitButtonPress(menu_wait());
+
+        int64_t start = esp_timer_get_time();
+        bool changed = applyCatalogUpdates();
+        menu_step(button, changed, start);
+
+        uint32_t took = esp_timer_get_time() - start;
+        menu_stats.steps++;
+        menu_stats.busy_us += took;
+        if (took > menu_stats.max_us) menu_stats.max_us = took;
+        if (button != 0) ESP_LOGD(TAG_DISP, "Menu step took %lu us", (unsigned long)took);
     }
 }
 
@@ -1335,12 +1746,31 @@ void showMainMenu(){      // Main Menu
 // --------------------------------------------------------
 
 void app_main(void) {  
+    state_lock   = xSemaphoreCreateMutex();
+    net_queue    = xQueueCreate(NET_QUEUE_LEN, sizeof(journal_entry_t));
+    button_queue = xQueueCreate(BUTTON_QUEUE_LEN, sizeof(button_event_t));
+    catalog_queue = xQueueCreate(CATALOG_QUEUE_LEN, sizeof(catalog_batch_t *));
+
     gpio_setup();
     ESP_LOGI(TAG_CODE, "GPIO configured");
 
+    // Navigation buttons, debounced by a timer ISR
+    const gpio_num_t button_pins[BUTTON_COUNT] = {UP, SELOK, DOWN};
+    buttons_init(button_pins, button_queue);
+
+    // Call capture, edges are queued by the ISR and handled by input_task
+    const gpio_num_t call_pins[CALL_COUNT] = {CALL1, CALL2, CALL3};
+    TaskHandle_t input;
+    journal_init();
+    telemetry_init();
+    xTaskCreatePinnedToCore(network_task, "network", 6144, NULL, NETWORK_PRIO, NULL, NETWORK_CORE);
+    xTaskCreatePinnedToCore(input_task, "input", 4096, NULL, INPUT_PRIO, &input, INPUT_CORE);
+    callcapture_init(call_pins, input);
+
     // Display setup
     *gpio_out_w1ts_reg |= (1 << BKLT);   // Switch on backlight
     _init_TFT();
+    disp_cls();                          // Known blank panel for the line by line redraws
     //disp_start();
     ESP_LOGI(TAG_DISP, "Display Initiated");
     vTaskDelay(pdMS_TO_TICKS(500));
@@ -1358,10 +1788,16 @@ void app_main(void) {
     initialiseDeptRecord();
 
     // ---------- FOR TESTING ------------    
-    #if defined(BUILDMETHOD_DEMO)
+    #if defined(BUILDMETHOD_DEMO) || defined(BUILDMETHOD_BENCHMARK)
         testCallRecords();
         testDeptRecords();
     #endif
+    #if defined(BUILDMETHOD_BENCHMARK)
+        benchmark_callframe();
+        benchmark_display();
+        benchmark_font();
+        benchmark_primitives();
+    #endif
     // -----------------------------------
 
     // Initialisation of NVS
@@ -1391,31 +1827,11 @@ void app_main(void) {
     // Register the WebSocket event handler
     esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)client);
     esp_websocket_client_start(client);
+    telemetry_set_client(client);
     ESP_LOGI(TAG_SOCK, "Socket connection initialised");*/
 
-    while(true) {
-        // Send data
-        //send_data_task(client);
-
-        int button = checkButtonPress();
-        int displayontime = 0;
+    // First state sent once the records are known
+    notify_state_change();
 
-        if (button == 2) {
-            *gpio_out_w1ts_reg |= (1 << BKLT);
-            disp_cls();
-            while(displayontime < 15) {
-                button = 0;
-                button = checkButtonPress();
-
-                showMainMenu();
-                vTaskDelay(pdMS_TO_TICKS(10));
-                displayontime++;
-            }  
-        }
-
-        // Turn off the display
-        *gpio_out_w1tc_reg |= (1 << BKLT);
-        
-        vTaskDelay(pdMS_TO_TICKS(1000));       
-    }
+    xTaskCreatePinnedToCore(ui_task, "ui", 4096, NULL, UI_PRIO, NULL, UI_CORE);
 }
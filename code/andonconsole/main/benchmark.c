@@ -0,0 +1,463 @@
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include "tft.h"
+#include "tftspi.h"
+#include "benchmark.h"
+#include "callframe.h"
+
+static const char *TAG_BENCH = "Benchmark";
+
+#define BENCH_ROUNDS 1000
+
+
+// --------------------------------------------------------
+//    Heap accounting through the cJSON hooks
+// --------------------------------------------------------
+
+typedef struct {
+    size_t in_use;
+    size_t peak;
+    uint32_t allocs;
+} heap_track_t;
+
+static heap_track_t heap_track;
+
+static void *track_malloc(size_t size) {
+    size_t *block = malloc(sizeof(size_t) + size);
+    if (block == NULL) return NULL;
+
+    *block = size;
+    heap_track.allocs++;
+    heap_track.in_use += size;
+    if (heap_track.in_use > heap_track.peak) heap_track.peak = heap_track.in_use;
+    return block + 1;
+}
+
+static void track_free(void *ptr) {
+    if (ptr == NULL) return;
+
+    size_t *block = (size_t *)ptr - 1;
+    heap_track.in_use -= *block;
+    free(block);
+}
+
+
+// --------------------------------------------------------
+//    Call frame serialisation
+// --------------------------------------------------------
+
+static const callframe_t bench_frame = {
+    .consoleid  = 12345,
+    .department = "2",
+    .active     = 0x5,
+    .status     = {"Red", "Yellow", "Green"},
+    .oldcall    = CALLFRAME_LIVE,
+};
+
+// Frame built the way send_data_task() did before callframe_json()
+static int cjson_frame(const callframe_t *frame, char *out, size_t size) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "consoleid", frame->consoleid);
+    cJSON_AddStringToObject(json, "department", frame->department ? frame->department : "Undefined");
+    cJSON_AddStringToObject(json, "call1", (frame->active & 1) ? frame->status[0] : "");
+    cJSON_AddStringToObject(json, "call2", (frame->active & 2) ? frame->status[1] : "");
+    cJSON_AddStringToObject(json, "call3", (frame->active & 4) ? frame->status[2] : "");
+    cJSON_AddStringToObject(json, "oldcall", "");
+
+    char *json_string = cJSON_PrintUnformatted(json);
+    int len = strlen(json_string);
+    strlcpy(out, json_string, size);
+
+    cJSON_free(json_string);
+    cJSON_Delete(json);
+    return len;
+}
+
+void benchmark_callframe(void) {
+    static char out_cjson[CALLFRAME_JSON_MAX];
+    static char out_static[CALLFRAME_JSON_MAX];
+    static uint8_t out_bin[CALLFRAME_BIN_LEN];
+    uint32_t start, cycles_cjson, cycles_static, cycles_bin;
+    size_t low_before, low_cjson, low_static;
+
+    // cJSON tree, allocations counted through the hooks
+    cJSON_Hooks hooks = {.malloc_fn = track_malloc, .free_fn = track_free};
+    cJSON_InitHooks(&hooks);
+    memset(&heap_track, 0, sizeof(heap_track));
+
+    low_before = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        cjson_frame(&bench_frame, out_cjson, sizeof(out_cjson));
+    }
+    cycles_cjson = esp_cpu_get_cycle_count() - start;
+    low_cjson = low_before - heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    cJSON_InitHooks(NULL);
+
+    // Static buffer serialiser
+    low_before = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        callframe_json(&bench_frame, out_static, sizeof(out_static));
+    }
+    cycles_static = esp_cpu_get_cycle_count() - start;
+    low_static = low_before - heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+
+    // Binary frame
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        callframe_bin(&bench_frame, out_bin, sizeof(out_bin));
+    }
+    cycles_bin = esp_cpu_get_cycle_count() - start;
+
+    if (strcmp(out_cjson, out_static) != 0) {
+        ESP_LOGE(TAG_BENCH, "Frames differ:\n  cJSON:  %s\n  static: %s", out_cjson, out_static);
+    }
+
+    ESP_LOGI(TAG_BENCH, "Call frame, %d rounds: %s", BENCH_ROUNDS, out_static);
+    ESP_LOGI(TAG_BENCH, "  cJSON:  %lu cycles/frame, %lu allocs/frame, peak %u bytes in use, heap low-water lowered by %u bytes",
+             (unsigned long)(cycles_cjson / BENCH_ROUNDS), (unsigned long)(heap_track.allocs / BENCH_ROUNDS),
+             (unsigned)heap_track.peak, (unsigned)low_cjson);
+    ESP_LOGI(TAG_BENCH, "  static: %lu cycles/frame, 0 allocs/frame, heap low-water lowered by %u bytes",
+             (unsigned long)(cycles_static / BENCH_ROUNDS), (unsigned)low_static);
+    ESP_LOGI(TAG_BENCH, "  binary: %lu cycles/frame, %d bytes against %d bytes of JSON",
+             (unsigned long)(cycles_bin / BENCH_ROUNDS), CALLFRAME_BIN_LEN, (int)strlen(out_static));
+}
+
+
+// --------------------------------------------------------
+//    Display pixel pipeline
+// --------------------------------------------------------
+
+#define BENCH_DISPLAY_ROUNDS 20
+#define BENCH_TEXT_LINES     7
+
+typedef struct {
+    uint32_t bytes;         // Pixel bytes sent per round
+    uint32_t us;            // Time per round
+} display_run_t;
+
+static void bench_fill(int round) {
+    TFT_fillScreen((round & 1) ? TFT_BLACK : TFT_NAVY);
+}
+
+// A menu screen worth of text, redrawn in full
+static void bench_text(int round) {
+    TFT_setFont(DEFAULT_FONT, NULL);
+    tft_fg = (round & 1) ? TFT_WHITE : TFT_YELLOW;
+    tft_bg = TFT_BLACK;
+    for (int line = 0; line < BENCH_TEXT_LINES; line++) {
+        TFT_print("Maintenance  Red", 2, 2 + line * 18);
+    }
+}
+
+static void display_run(void (*draw)(int), display_run_t *run) {
+    uint32_t bytes = tft_pixel_bytes;
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < BENCH_DISPLAY_ROUNDS; i++) {
+        draw(i);
+        TFT_flush();                    // Sends the drawing when it went to the framebuffer
+    }
+    wait_trans_finish(1);
+
+    run->us = (esp_timer_get_time() - start) / BENCH_DISPLAY_ROUNDS;
+    run->bytes = (tft_pixel_bytes - bytes) / BENCH_DISPLAY_ROUNDS;
+}
+
+void benchmark_display(void) {
+    display_run_t fill, text;
+    int pixel_bytes = sizeof(tft_pixel_t);
+
+    display_run(bench_fill, &fill);
+    display_run(bench_text, &text);
+
+    TFT_fillScreen(TFT_BLACK);
+    TFT_flush();
+
+    // 18-bit color sends 3 bytes for every pixel
+    ESP_LOGI(TAG_BENCH, "Display, %d-bit color, %d rounds:", pixel_bytes == 2 ? 16 : 18, BENCH_DISPLAY_ROUNDS);
+    ESP_LOGI(TAG_BENCH, "  fill: %lu bytes, %lu us per screen, 18-bit color would send %lu bytes",
+             (unsigned long)fill.bytes, (unsigned long)fill.us, (unsigned long)(fill.bytes / pixel_bytes * 3));
+    ESP_LOGI(TAG_BENCH, "  text: %lu bytes, %lu us per %d lines, 18-bit color would send %lu bytes",
+             (unsigned long)text.bytes, (unsigned long)text.us, BENCH_TEXT_LINES, (unsigned long)(text.bytes / pixel_bytes * 3));
+}
+
+
+// --------------------------------------------------------
+//    Proportional font glyph lookup
+// --------------------------------------------------------
+
+#define BENCH_FONT_ROUNDS 200
+
+static const char *bench_font_text = "Maintenance  Red";
+
+// Finds a character walking the font from its first glyph, the way
+// getCharPtr() did before the font had an index. Returns its xDelta.
+static int linear_char_delta(const uint8_t *font, uint8_t c) {
+    int ptr = 4;
+
+    while (font[ptr] != 0xFF) {
+        uint8_t width = font[ptr + 2];
+        uint8_t height = font[ptr + 3];
+        if (font[ptr] == c) return font[ptr + 5];
+        ptr += 6;
+        if (width != 0) ptr += ((width * height - 1) / 8) + 1;
+    }
+    return 0;
+}
+
+static int linear_string_width(const uint8_t *font, const char *str) {
+    int width = 0;
+    while (*str) width += linear_char_delta(font, (uint8_t)*str++);
+    return width;
+}
+
+// Walks every glyph of the font, as TFT_setFont() did on every call
+static int linear_font_walk(const uint8_t *font) {
+    int ptr = 4, chars = 0;
+
+    while (font[ptr] != 0xFF) {
+        uint8_t width = font[ptr + 2];
+        uint8_t height = font[ptr + 3];
+        ptr += 6;
+        if (width != 0) ptr += ((width * height - 1) / 8) + 1;
+        chars++;
+    }
+    return chars;
+}
+
+void benchmark_font(void) {
+    volatile int sink = 0;
+    uint32_t start;
+
+    TFT_setFont(DEFAULT_FONT, NULL);
+    const uint8_t *font = tft_cfont.font;
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_FONT_ROUNDS; i++) sink += linear_string_width(font, bench_font_text);
+    uint32_t cycles_width_linear = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_FONT_ROUNDS; i++) sink += TFT_getStringWidth((char *)bench_font_text);
+    uint32_t cycles_width_index = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_FONT_ROUNDS; i++) sink += linear_font_walk(font);
+    uint32_t cycles_set_linear = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_FONT_ROUNDS; i++) TFT_setFont(DEFAULT_FONT, NULL);
+    uint32_t cycles_set_index = esp_cpu_get_cycle_count() - start;
+
+    tft_fg = TFT_WHITE;
+    tft_bg = TFT_BLACK;
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < BENCH_FONT_ROUNDS; i++) {
+        TFT_setFont(DEFAULT_FONT, NULL);            // As disp_write() does before every line
+        TFT_print((char *)bench_font_text, 2, 2);
+    }
+    wait_trans_finish(1);
+    uint32_t cycles_print = esp_cpu_get_cycle_count() - start;
+
+    TFT_fillScreen(TFT_BLACK);
+    TFT_flush();
+
+    ESP_LOGI(TAG_BENCH, "Font lookup, %d rounds: \"%s\"", BENCH_FONT_ROUNDS, bench_font_text);
+    ESP_LOGI(TAG_BENCH, "  string width: %lu cycles walking the font, %lu cycles through the index",
+             (unsigned long)(cycles_width_linear / BENCH_FONT_ROUNDS), (unsigned long)(cycles_width_index / BENCH_FONT_ROUNDS));
+    ESP_LOGI(TAG_BENCH, "  set font: %lu cycles walking the font, %lu cycles reusing the index",
+             (unsigned long)(cycles_set_linear / BENCH_FONT_ROUNDS), (unsigned long)(cycles_set_index / BENCH_FONT_ROUNDS));
+    ESP_LOGI(TAG_BENCH, "  set font and print: %lu cycles", (unsigned long)(cycles_print / BENCH_FONT_ROUNDS));
+}
+
+
+// --------------------------------------------------------
+//    Outline primitives
+// --------------------------------------------------------
+
+#define BENCH_PRIM_ROUNDS 50
+
+// A status gauge and an indicator dot of the dashboard, and a triangle marker
+#define BENCH_GAUGE_X     80
+#define BENCH_GAUGE_Y     64
+#define BENCH_GAUGE_R     40
+#define BENCH_GAUGE_TH    8
+#define BENCH_DOT_R       12
+
+// Circle outline one pixel at a time, as TFT_drawCircle() did before spans
+static void pixel_circle(int16_t x, int16_t y, int radius, color_t color) {
+    int f = 1 - radius;
+    int ddF_x = 1;
+    int ddF_y = -2 * radius;
+    int x1 = 0;
+    int y1 = radius;
+
+    disp_select();
+    TFT_drawPixel(x, y + radius, color, 0);
+    TFT_drawPixel(x, y - radius, color, 0);
+    TFT_drawPixel(x + radius, y, color, 0);
+    TFT_drawPixel(x - radius, y, color, 0);
+    while (x1 < y1) {
+        if (f >= 0) {
+            y1--;
+            ddF_y += 2;
+            f += ddF_y;
+        }
+        x1++;
+        ddF_x += 2;
+        f += ddF_x;
+        TFT_drawPixel(x + x1, y + y1, color, 0);
+        TFT_drawPixel(x - x1, y + y1, color, 0);
+        TFT_drawPixel(x + x1, y - y1, color, 0);
+        TFT_drawPixel(x - x1, y - y1, color, 0);
+        TFT_drawPixel(x + y1, y + x1, color, 0);
+        TFT_drawPixel(x - y1, y + x1, color, 0);
+        TFT_drawPixel(x + y1, y - x1, color, 0);
+        TFT_drawPixel(x - y1, y - x1, color, 0);
+    }
+    disp_deselect();
+}
+
+// Arc from 'start' to 'end' degrees (0 at 3 o'clock, start < end), one pixel
+// at a time, as _fillArcOffsetted() did before spans
+static void pixel_arc(int16_t cx, int16_t cy, int radius, int thickness, float start, float end, color_t color) {
+    float sslope = cos(start / 360 * 2 * PI) / sin(start / 360 * 2 * PI);
+    float eslope = cos(end / 360 * 2 * PI) / sin(end / 360 * 2 * PI);
+    if (end == 360) eslope = -1000000;
+
+    int ir2 = (radius - thickness) * (radius - thickness);
+    int or2 = radius * radius;
+
+    disp_select();
+    for (int x = -radius; x <= radius; x++) {
+        for (int y = -radius; y <= radius; y++) {
+            int d2 = x * x + y * y;
+            if ((d2 < or2 && d2 >= ir2) &&
+                ((y > 0 && start < 180 && x <= y * sslope) || (y < 0 && start > 180 && x >= y * sslope) ||
+                 (y < 0 && start <= 180) || (y == 0 && start <= 180 && x < 0) || (y == 0 && start == 0 && x > 0)) &&
+                ((y > 0 && end < 180 && x >= y * eslope) || (y < 0 && end > 180 && x <= y * eslope) ||
+                 (y > 0 && end >= 180) || (y == 0 && end >= 180 && x < 0) || (y == 0 && start == 0 && x > 0))) {
+                TFT_drawPixel(cx + x, cy + y, color, 0);
+            }
+        }
+    }
+    disp_deselect();
+}
+
+static void segment_draw(int16_t xs, int16_t y, int16_t len, int steep, color_t color) {
+    if (len == 1) TFT_drawPixel(steep ? y : xs, steep ? xs : y, color, 1);
+    else if (steep) TFT_drawFastVLine(y, xs, len, color);
+    else TFT_drawFastHLine(xs, y, len, color);
+}
+
+// Bresenham line with the display selected for every segment,
+// as _drawLine() did before spans
+static void segment_line(int16_t x0, int16_t y0, int16_t x1, int16_t y1, color_t color) {
+    int steep = abs(y1 - y0) > abs(x1 - x0);
+    int16_t t;
+
+    if (steep) {
+        t = x0; x0 = y0; y0 = t;
+        t = x1; x1 = y1; y1 = t;
+    }
+    if (x0 > x1) {
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+
+    int16_t dx = x1 - x0, dy = abs(y1 - y0);
+    int16_t err = dx >> 1, ystep = (y0 < y1) ? 1 : -1, xs = x0, dlen = 0;
+
+    for (; x0 <= x1; x0++) {
+        dlen++;
+        err -= dy;
+        if (err < 0) {
+            err += dx;
+            segment_draw(xs, y0, dlen, steep, color);
+            dlen = 0; y0 += ystep; xs = x0 + 1;
+        }
+    }
+    if (dlen) segment_draw(xs, y0, dlen, steep, color);
+}
+
+static void before_dot(int round) {
+    pixel_circle(BENCH_GAUGE_X, BENCH_GAUGE_Y, BENCH_DOT_R, (round & 1) ? TFT_GREEN : TFT_RED);
+}
+
+static void after_dot(int round) {
+    TFT_drawCircle(BENCH_GAUGE_X, BENCH_GAUGE_Y, BENCH_DOT_R, (round & 1) ? TFT_GREEN : TFT_RED);
+}
+
+static void before_gauge(int round) {
+    pixel_arc(BENCH_GAUGE_X, BENCH_GAUGE_Y, BENCH_GAUGE_R, BENCH_GAUGE_TH, 0, 270, (round & 1) ? TFT_GREEN : TFT_RED);
+}
+
+// tft_angleOffset of -90 turns 90..360 into 0..270 from 3 o'clock
+static void after_gauge(int round) {
+    color_t color = (round & 1) ? TFT_GREEN : TFT_RED;
+    TFT_drawArc(BENCH_GAUGE_X, BENCH_GAUGE_Y, BENCH_GAUGE_R, BENCH_GAUGE_TH, 90, 360, color, color);
+}
+
+static void before_line(int round) {
+    segment_line(0, 0, tft_width - 1, tft_height - 1, (round & 1) ? TFT_WHITE : TFT_CYAN);
+}
+
+static void after_line(int round) {
+    TFT_drawLine(0, 0, tft_width - 1, tft_height - 1, (round & 1) ? TFT_WHITE : TFT_CYAN);
+}
+
+static void before_triangle(int round) {
+    color_t color = (round & 1) ? TFT_WHITE : TFT_YELLOW;
+    segment_line(80, 10, 20, 110, color);
+    segment_line(20, 110, 140, 100, color);
+    segment_line(140, 100, 80, 10, color);
+}
+
+static void after_triangle(int round) {
+    TFT_drawTriangle(80, 10, 20, 110, 140, 100, (round & 1) ? TFT_WHITE : TFT_YELLOW);
+}
+
+// Time per call of 'draw', the framebuffer (if any) is sent outside the timing
+static uint32_t prim_run(void (*draw)(int)) {
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < BENCH_PRIM_ROUNDS; i++) draw(i);
+    wait_trans_finish(1);
+    uint32_t us = (esp_timer_get_time() - start) / BENCH_PRIM_ROUNDS;
+
+    TFT_fillScreen(TFT_BLACK);
+    TFT_flush();
+    return us;
+}
+
+void benchmark_primitives(void) {
+    static const struct {
+        const char *name;
+        void (*before)(int);
+        void (*after)(int);
+    } prims[] = {
+        {"indicator dot, circle r=12", before_dot, after_dot},
+        {"status gauge, arc r=40 th=8", before_gauge, after_gauge},
+        {"diagonal line", before_line, after_line},
+        {"triangle outline", before_triangle, after_triangle},
+    };
+
+    TFT_fillScreen(TFT_BLACK);
+    TFT_flush();
+
+    ESP_LOGI(TAG_BENCH, "Outline primitives, %d rounds:", BENCH_PRIM_ROUNDS);
+    for (int i = 0; i < sizeof(prims) / sizeof(prims[0]); i++) {
+        uint32_t us_before = prim_run(prims[i].before);
+        uint32_t us_after = prim_run(prims[i].after);
+
+        ESP_LOGI(TAG_BENCH, "  %s: %lu us before, %lu us as spans",
+                 prims[i].name, (unsigned long)us_before, (unsigned long)us_after);
+    }
+}
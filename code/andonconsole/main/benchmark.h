@@ -0,0 +1,23 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+// -----------------------------------------------------------
+//    On-target benchmarks, run at boot by BUILDMETHOD=BENCHMARK
+// -----------------------------------------------------------
+
+// Serialising a call frame: callframe_json() against the former cJSON tree
+void benchmark_callframe(void);
+
+// Full screen fills and text redraws: bytes sent to the display and time,
+// for the pixel format the tft component is built with
+void benchmark_display(void);
+
+// Proportional font glyph lookup: string width and TFT_setFont() walking
+// the font the former way against the per-font index, and the cost of a print
+void benchmark_font(void);
+
+// Circle, arc, line and triangle outlines drawn the former way (a window
+// per pixel or segment) against spans, time per primitive
+void benchmark_primitives(void);
+
+#endif
@@ -0,0 +1,109 @@
+#include "buttons.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gptimer.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+
+static const char *TAG_BUTTONS = "Buttons";
+
+#define DEBOUNCE_SAMPLES    ((BUTTON_DEBOUNCE_MS + BUTTON_SAMPLE_MS - 1) / BUTTON_SAMPLE_MS)
+
+typedef struct {
+    gpio_num_t pin;
+    bool     pressed;       // Debounced level
+    uint8_t  unstable;      // Samples in a row differing from 'pressed'
+    uint32_t held_ms;       // Time since the press
+    uint32_t next_ms;       // When the next long press or repeat is due
+} button_state_t;
+
+static button_state_t buttons[BUTTON_COUNT];
+static QueueHandle_t button_queue = NULL;
+static volatile uint32_t button_dropped = 0;
+
+// Reads the pin straight from the input registers, safe inside the ISR
+static inline bool IRAM_ATTR read_button_pin(gpio_num_t pin) {
+    if (pin < 32) return (REG_READ(GPIO_IN_REG) >> pin) & 1;
+    return (REG_READ(GPIO_IN1_REG) >> (pin - 32)) & 1;
+}
+
+static void IRAM_ATTR send_event(uint8_t button, button_event_type_t type, int64_t now, BaseType_t *woken) {
+    button_event_t evt = {
+        .timestamp = now,
+        .button = button,
+        .type = type,
+    };
+    if (xQueueSendFromISR(button_queue, &evt, woken) != pdTRUE) button_dropped++;
+}
+
+// Timer alarm, every BUTTON_SAMPLE_MS
+static bool IRAM_ATTR sample_buttons(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *arg) {
+    int64_t now = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        button_state_t *b = &buttons[i];
+        uint8_t button = i + 1;
+
+        if (read_button_pin(b->pin) != b->pressed) {
+            if (++b->unstable >= DEBOUNCE_SAMPLES) {
+                b->pressed = !b->pressed;
+                b->unstable = 0;
+                b->held_ms = 0;
+                b->next_ms = BUTTON_LONG_MS;
+                send_event(button, b->pressed ? BUTTON_PRESS : BUTTON_RELEASE, now, &woken);
+            }
+            continue;
+        }
+        b->unstable = 0;        // Bounce, back to the debounced level
+
+        if (!b->pressed) continue;
+
+        b->held_ms += BUTTON_SAMPLE_MS;
+        if (b->held_ms >= b->next_ms) {
+            send_event(button, b->next_ms == BUTTON_LONG_MS ? BUTTON_LONG : BUTTON_REPEAT, now, &woken);
+            b->next_ms += BUTTON_REPEAT_MS;
+        }
+    }
+    return woken == pdTRUE;
+}
+
+void buttons_init(const gpio_num_t pins[BUTTON_COUNT], QueueHandle_t queue) {
+    button_queue = queue;
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        buttons[i].pin = pins[i];
+        buttons[i].pressed = read_button_pin(pins[i]);      // Held at boot, no press until released
+    }
+
+    gptimer_handle_t timer = NULL;
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,       // 1 us per tick
+    };
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = BUTTON_SAMPLE_MS * 1000,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    gptimer_event_callbacks_t callbacks = {
+        .on_alarm = sample_buttons,
+    };
+
+    esp_err_t err = gptimer_new_timer(&timer_config, &timer);
+    if (err == ESP_OK) err = gptimer_register_event_callbacks(timer, &callbacks, NULL);
+    if (err == ESP_OK) err = gptimer_set_alarm_action(timer, &alarm_config);
+    if (err == ESP_OK) err = gptimer_enable(timer);
+    if (err == ESP_OK) err = gptimer_start(timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_BUTTONS, "Failed to start the sampling timer (%s)", esp_err_to_name(err));
+        return;
+    }
+    ESP_LOGI(TAG_BUTTONS, "Buttons sampled every %d ms, debounced over %d ms", BUTTON_SAMPLE_MS, BUTTON_DEBOUNCE_MS);
+}
+
+uint32_t buttons_dropped(void) {
+    return button_dropped;
+}
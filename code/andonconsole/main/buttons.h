@@ -0,0 +1,72 @@
+#ifndef _BUTTONS_H_
+#define _BUTTONS_H_
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+
+// -----------------------------------------------------------
+//    Debounced navigation buttons
+// -----------------------------------------------------------
+//
+// A hardware timer samples the buttons every BUTTON_SAMPLE_MS.
+// A level is accepted once it has been stable for
+// BUTTON_DEBOUNCE_MS, so a press is reported within about
+// 20 ms and one press gives one event, without the delays
+// the menus used to have.
+//
+// Held down for BUTTON_LONG_MS, a button reports a long press,
+// then repeats every BUTTON_REPEAT_MS until released.
+//
+// Events are queued straight from the timer ISR.
+//
+// -----------------------------------------------------------
+
+#ifndef BUTTON_SAMPLE_MS
+#define BUTTON_SAMPLE_MS    5
+#endif
+
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS  20
+#endif
+
+#ifndef BUTTON_LONG_MS
+#define BUTTON_LONG_MS      600
+#endif
+
+#ifndef BUTTON_REPEAT_MS
+#define BUTTON_REPEAT_MS    150
+#endif
+
+_Static_assert(BUTTON_DEBOUNCE_MS >= BUTTON_SAMPLE_MS, "BUTTON_DEBOUNCE_MS shorter than a sample");
+
+// Same numbers checkButtonPress() always returned
+#define BUTTON_UP       1
+#define BUTTON_SELOK    2
+#define BUTTON_DOWN     3
+#define BUTTON_COUNT    3
+
+typedef enum {
+    BUTTON_PRESS,
+    BUTTON_RELEASE,
+    BUTTON_LONG,            // Held for BUTTON_LONG_MS
+    BUTTON_REPEAT,          // Still held, every BUTTON_REPEAT_MS after the long press
+    BUTTON_WAKE,            // Not from a button, only wakes the task reading the queue
+} button_event_type_t;
+
+typedef struct {
+    int64_t  timestamp;     // esp_timer_get_time() when the event was detected, in us
+    uint8_t  button;        // BUTTON_UP, BUTTON_SELOK or BUTTON_DOWN
+    uint8_t  type;          // button_event_type_t
+} button_event_t;
+
+// Starts sampling 'pins' (indexed by button - 1, high when pressed).
+// Events are sent to 'queue', which holds button_event_t, and dropped
+// when it is full.
+void buttons_init(const gpio_num_t pins[BUTTON_COUNT], QueueHandle_t queue);
+
+// Number of events lost because the queue was full
+uint32_t buttons_dropped(void);
+
+#endif
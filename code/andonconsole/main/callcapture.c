@@ -0,0 +1,94 @@
+#include "callcapture.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+
+static const char *TAG_CALL = "CallCapture";
+
+static gpio_num_t call_pins[CALL_COUNT];
+static TaskHandle_t call_consumer = NULL;
+
+// Ring buffer, 'call_head' is only written by the ISR and 'call_tail'
+// only by the consumer, so no lock is needed between the two
+static call_event_t call_events[CALL_EVENT_QUEUE_LEN];
+static uint32_t call_head = 0;
+static uint32_t call_tail = 0;
+
+static volatile uint8_t  call_mask = 0;
+static volatile uint32_t call_dropped = 0;
+
+// Reads the pin straight from the input registers, safe inside the ISR
+static inline bool IRAM_ATTR read_call_pin(gpio_num_t pin) {
+    if (pin < 32) return (REG_READ(GPIO_IN_REG) >> pin) & 1;
+    return (REG_READ(GPIO_IN1_REG) >> (pin - 32)) & 1;
+}
+
+// Edge interrupt, shared by all call pins
+static void IRAM_ATTR call_isr_handler(void *arg) {
+    uint8_t call = (uint8_t)(uintptr_t)arg;
+    bool pressed = read_call_pin(call_pins[call]);
+
+    // Contact bounce back to the level already reported
+    if (pressed == ((call_mask >> call) & 1)) return;
+
+    uint32_t head = call_head;
+    uint32_t tail = __atomic_load_n(&call_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= CALL_EVENT_QUEUE_LEN) {
+        call_dropped++;
+        return;
+    }
+
+    call_event_t *evt = &call_events[head & (CALL_EVENT_QUEUE_LEN - 1)];
+    evt->timestamp = esp_timer_get_time();
+    evt->call = call;
+    evt->pressed = pressed;
+    __atomic_store_n(&call_head, head + 1, __ATOMIC_RELEASE);
+
+    if (pressed) call_mask |= (1 << call);
+    else call_mask &= ~(1 << call);
+
+    BaseType_t woken = pdFALSE;
+    if (call_consumer != NULL) vTaskNotifyGiveFromISR(call_consumer, &woken);
+    if (woken == pdTRUE) portYIELD_FROM_ISR();
+}
+
+void callcapture_init(const gpio_num_t pins[CALL_COUNT], TaskHandle_t consumer) {
+    call_consumer = consumer;
+
+    for (int i = 0; i < CALL_COUNT; i++) {
+        call_pins[i] = pins[i];
+        if (read_call_pin(pins[i])) call_mask |= (1 << i);
+    }
+
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {     // INVALID_STATE: already installed
+        ESP_LOGE(TAG_CALL, "Failed to install ISR service (%s)", esp_err_to_name(err));
+        return;
+    }
+
+    for (int i = 0; i < CALL_COUNT; i++) {
+        gpio_set_intr_type(pins[i], GPIO_INTR_ANYEDGE);
+        gpio_isr_handler_add(pins[i], call_isr_handler, (void *)(uintptr_t)i);
+    }
+    ESP_LOGI(TAG_CALL, "Call capture started, initial state 0x%02x", call_mask);
+}
+
+bool callcapture_pop(call_event_t *evt) {
+    uint32_t tail = call_tail;
+    uint32_t head = __atomic_load_n(&call_head, __ATOMIC_ACQUIRE);
+    if (tail == head) return false;
+
+    *evt = call_events[tail & (CALL_EVENT_QUEUE_LEN - 1)];
+    __atomic_store_n(&call_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint8_t callcapture_state(void) {
+    return call_mask;
+}
+
+uint32_t callcapture_dropped(void) {
+    return call_dropped;
+}
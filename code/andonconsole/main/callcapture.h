@@ -0,0 +1,45 @@
+#ifndef _CALLCAPTURE_H_
+#define _CALLCAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+
+// -----------------------------------------------------------
+//    Interrupt driven capture of the call inputs
+// -----------------------------------------------------------
+//
+// Every edge on a call pin is timestamped in the GPIO ISR and
+// pushed into a single producer / single consumer ring. The
+// consumer task is woken with a task notification, so a press
+// reaches the network within milliseconds and presses shorter
+// than any polling interval are never missed.
+//
+// -----------------------------------------------------------
+
+#define CALL_COUNT           3
+#define CALL_EVENT_QUEUE_LEN 32     // Must be a power of two
+
+typedef struct {
+    int64_t timestamp;      // esp_timer_get_time() at the edge, in us
+    uint8_t call;           // 0 .. CALL_COUNT-1
+    bool    pressed;        // Level of the pin after the edge
+} call_event_t;
+
+// Configures the call pins for any-edge interrupts and starts capturing.
+// 'consumer' is notified (xTaskNotifyGive) whenever new events are queued.
+void callcapture_init(const gpio_num_t pins[CALL_COUNT], TaskHandle_t consumer);
+
+// Pops the oldest event, returns false if the queue is empty.
+// Must only be called from the consumer task.
+bool callcapture_pop(call_event_t *evt);
+
+// Bitmask of the calls active at the last queued edge (bit n = call n+1)
+uint8_t callcapture_state(void);
+
+// Number of edges lost because the queue was full
+uint32_t callcapture_dropped(void);
+
+#endif
@@ -0,0 +1,339 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "callframe.h"
+
+// Bounded writer over the caller's buffer, 'pos' is set to NULL on overflow
+typedef struct {
+    char *pos;
+    char *end;      // Last usable byte, kept for the terminator
+} writer_t;
+
+static void put(writer_t *w, const char *s, size_t len) {
+    if (w->pos == NULL) return;
+    if ((size_t)(w->end - w->pos) < len) {
+        w->pos = NULL;
+        return;
+    }
+    memcpy(w->pos, s, len);
+    w->pos += len;
+}
+
+static void put_str(writer_t *w, const char *s) {
+    put(w, s, strlen(s));
+}
+
+static void put_long(writer_t *w, long value) {
+    char digits[24];
+    int n = sizeof(digits);
+    unsigned long v = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+    do {
+        digits[--n] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) digits[--n] = '-';
+
+    put(w, &digits[n], sizeof(digits) - n);
+}
+
+// Writes a quoted JSON string, escaping it the way cJSON does
+static void put_quoted(writer_t *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+
+    put(w, "\"", 1);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        put(w, run, s - run);
+        run = s + 1;
+        switch (c) {
+            case '"':  put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\b': put(w, "\\b", 2);  break;
+            case '\f': put(w, "\\f", 2);  break;
+            case '\n': put(w, "\\n", 2);  break;
+            case '\r': put(w, "\\r", 2);  break;
+            case '\t': put(w, "\\t", 2);  break;
+            default: {
+                char esc[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                put(w, esc, sizeof(esc));
+            }
+        }
+    }
+    put(w, run, s - run);
+    put(w, "\"", 1);
+}
+
+int callframe_json(const callframe_t *frame, char *buf, size_t size) {
+    static const char *call_keys[CALLFRAME_CALLS] = {",\"call1\":", ",\"call2\":", ",\"call3\":"};
+
+    if (buf == NULL || size == 0) return -1;
+    writer_t w = {buf, buf + size - 1};
+
+    put_str(&w, "{\"consoleid\":");
+    put_long(&w, frame->consoleid);
+
+    put_str(&w, ",\"department\":");
+    put_quoted(&w, frame->department ? frame->department : "Undefined");
+
+    for (int i = 0; i < CALLFRAME_CALLS; i++) {
+        put_str(&w, call_keys[i]);
+        if (frame->active & (1 << i)) put_quoted(&w, frame->status[i] ? frame->status[i] : "Undefined");
+        else put(&w, "\"\"", 2);
+    }
+
+    put_str(&w, ",\"oldcall\":\"");
+    if (frame->oldcall != CALLFRAME_LIVE) put_long(&w, frame->oldcall);
+    put(&w, "\"", 1);
+
+    if (frame->seq) {
+        put_str(&w, ",\"seq\":");
+        put_long(&w, frame->seq);
+    }
+    put(&w, "}", 1);
+
+    if (w.pos == NULL) {
+        buf[0] = '\0';
+        return -1;
+    }
+    *w.pos = '\0';
+    return w.pos - buf;
+}
+
+
+// --------------------------------------------------------
+//    Binary frame
+// --------------------------------------------------------
+
+static const char *status_names[] = {"Undefined", "Red", "Yellow", "Green"};
+
+callframe_status_t callframe_status(const char *status) {
+    if (status == NULL) return CALLFRAME_STATUS_UNDEFINED;
+    for (int i = CALLFRAME_STATUS_RED; i <= CALLFRAME_STATUS_GREEN; i++) {
+        if (strcasecmp(status, status_names[i]) == 0) return (callframe_status_t)i;
+    }
+    return CALLFRAME_STATUS_UNDEFINED;
+}
+
+const char *callframe_status_name(callframe_status_t status) {
+    if (status > CALLFRAME_STATUS_GREEN) return status_names[CALLFRAME_STATUS_UNDEFINED];
+    return status_names[status];
+}
+
+// Department ids are numeric strings, anything else is sent as undefined
+static uint16_t department_id(const char *department) {
+    if (department == NULL || *department == '\0') return CALLFRAME_DEPT_UNDEFINED;
+
+    char *end;
+    unsigned long id = strtoul(department, &end, 10);
+    if (*end != '\0' || id >= CALLFRAME_DEPT_UNDEFINED) return CALLFRAME_DEPT_UNDEFINED;
+    return (uint16_t)id;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int callframe_bin(const callframe_t *frame, uint8_t *buf, size_t size) {
+    bool oldcall = frame->oldcall != CALLFRAME_LIVE;
+    size_t len = oldcall ? CALLFRAME_BIN_OLDCALL_LEN : CALLFRAME_BIN_LEN;
+    if (buf == NULL || size < len) return -1;
+
+    memset(buf, 0, len);
+    buf[CALLFRAME_OFS_MAGIC]   = CALLFRAME_BIN_MAGIC;
+    buf[CALLFRAME_OFS_VERSION] = CALLFRAME_BIN_VERSION;
+    buf[CALLFRAME_OFS_TYPE]    = oldcall ? CALLFRAME_TYPE_OLDCALL : CALLFRAME_TYPE_STATE;
+    put_u32(&buf[CALLFRAME_OFS_CONSOLE], (uint32_t)frame->consoleid);
+    put_u16(&buf[CALLFRAME_OFS_DEPT], department_id(frame->department));
+    buf[CALLFRAME_OFS_ACTIVE]  = frame->active & ((1 << CALLFRAME_CALLS) - 1);
+    for (int i = 0; i < CALLFRAME_CALLS; i++) {
+        buf[CALLFRAME_OFS_STATUS + i] = callframe_status(frame->status[i]);
+    }
+    put_u16(&buf[CALLFRAME_OFS_SEQ], frame->seq);
+    if (oldcall) put_u32(&buf[CALLFRAME_OFS_AGE], (uint32_t)frame->oldcall);
+    return len;
+}
+
+int callframe_bin_decode(const uint8_t *buf, size_t len, callframe_bin_t *out) {
+    if (len < CALLFRAME_OFS_TYPE + 1) return CALLFRAME_ERR_SHORT;
+    if (buf[CALLFRAME_OFS_MAGIC] != CALLFRAME_BIN_MAGIC) return CALLFRAME_ERR_MAGIC;
+    if (buf[CALLFRAME_OFS_VERSION] != CALLFRAME_BIN_VERSION) return CALLFRAME_ERR_VERSION;
+
+    size_t frame_len;
+    switch (buf[CALLFRAME_OFS_TYPE]) {
+        case CALLFRAME_TYPE_STATE:   frame_len = CALLFRAME_BIN_LEN;         break;
+        case CALLFRAME_TYPE_OLDCALL: frame_len = CALLFRAME_BIN_OLDCALL_LEN; break;
+        default: return CALLFRAME_ERR_TYPE;
+    }
+    if (len < frame_len) return CALLFRAME_ERR_SHORT;
+
+    out->version    = buf[CALLFRAME_OFS_VERSION];
+    out->type       = buf[CALLFRAME_OFS_TYPE];
+    out->flags      = buf[CALLFRAME_OFS_FLAGS];
+    out->consoleid  = get_u32(&buf[CALLFRAME_OFS_CONSOLE]);
+    out->department = get_u16(&buf[CALLFRAME_OFS_DEPT]);
+    out->active     = buf[CALLFRAME_OFS_ACTIVE];
+    for (int i = 0; i < CALLFRAME_CALLS; i++) {
+        out->status[i] = buf[CALLFRAME_OFS_STATUS + i];
+    }
+    out->seq     = get_u16(&buf[CALLFRAME_OFS_SEQ]);
+    out->oldcall = (frame_len == CALLFRAME_BIN_OLDCALL_LEN)
+                 ? (int32_t)get_u32(&buf[CALLFRAME_OFS_AGE]) : CALLFRAME_LIVE;
+    return (int)frame_len;
+}
+
+
+// --------------------------------------------------------
+//    Acknowledgements
+// --------------------------------------------------------
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int callframe_ack_json(const char *buf, size_t len, uint16_t *seq) {
+    static const char key[] = "\"ack\"";
+    const size_t key_len = sizeof(key) - 1;
+    const char *end = buf + len;
+
+    for (const char *p = buf; p + key_len <= end; p++) {
+        if (memcmp(p, key, key_len) != 0) continue;
+
+        p += key_len;
+        while (p < end && is_space(*p)) p++;
+        if (p == end || *p++ != ':') return -1;
+        while (p < end && is_space(*p)) p++;
+
+        unsigned long value = 0;
+        const char *digits = p;
+        while (p < end && *p >= '0' && *p <= '9' && value <= 0xFFFF) value = value * 10 + (*p++ - '0');
+        if (p == digits || value == 0 || value > 0xFFFF) return -1;
+
+        *seq = (uint16_t)value;
+        return 0;
+    }
+    return -1;
+}
+
+int callframe_ack_bin(const uint8_t *buf, size_t len, uint16_t *seq) {
+    if (len < CALLFRAME_ACK_LEN ||
+        buf[CALLFRAME_OFS_MAGIC] != CALLFRAME_BIN_MAGIC ||
+        buf[CALLFRAME_OFS_VERSION] != CALLFRAME_BIN_VERSION ||
+        buf[CALLFRAME_OFS_TYPE] != CALLFRAME_TYPE_ACK) return -1;
+
+    *seq = get_u16(&buf[CALLFRAME_OFS_ACK_SEQ]);
+    return (*seq == 0) ? -1 : 0;
+}
+
+int callframe_ack_bin_encode(uint16_t seq, uint8_t *buf, size_t size) {
+    if (buf == NULL || size < CALLFRAME_ACK_LEN) return -1;
+
+    memset(buf, 0, CALLFRAME_ACK_LEN);
+    buf[CALLFRAME_OFS_MAGIC]   = CALLFRAME_BIN_MAGIC;
+    buf[CALLFRAME_OFS_VERSION] = CALLFRAME_BIN_VERSION;
+    buf[CALLFRAME_OFS_TYPE]    = CALLFRAME_TYPE_ACK;
+    put_u16(&buf[CALLFRAME_OFS_ACK_SEQ], seq);
+    return CALLFRAME_ACK_LEN;
+}
+
+
+// --------------------------------------------------------
+//    Statistics frame
+// --------------------------------------------------------
+
+static const uint32_t hist_bounds[CALLFRAME_HIST_BUCKETS - 1] = CALLFRAME_HIST_BOUNDS;
+
+int callframe_hist_bucket(uint32_t latency_ms) {
+    int i = 0;
+    while (i < CALLFRAME_HIST_BUCKETS - 1 && latency_ms > hist_bounds[i]) i++;
+    return i;
+}
+
+static void put_array(writer_t *w, const uint32_t *values, int count) {
+    put(w, "[", 1);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) put(w, ",", 1);
+        put_long(w, values[i]);
+    }
+    put(w, "]", 1);
+}
+
+int callframe_stats_json(long consoleid, const callframe_stats_t *stats, char *buf, size_t size) {
+    if (buf == NULL || size == 0) return -1;
+    writer_t w = {buf, buf + size - 1};
+
+    put_str(&w, "{\"consoleid\":");
+    put_long(&w, consoleid);
+    put_str(&w, ",\"stats\":{\"acked\":");
+    put_long(&w, stats->acked);
+    put_str(&w, ",\"retransmits\":");
+    put_long(&w, stats->retransmits);
+    put_str(&w, ",\"expired\":");
+    put_long(&w, stats->expired);
+    put_str(&w, ",\"hist_ms\":");
+    put_array(&w, hist_bounds, CALLFRAME_HIST_BUCKETS - 1);
+    put_str(&w, ",\"hist\":");
+    put_array(&w, stats->hist, CALLFRAME_HIST_BUCKETS);
+    put(&w, "}}", 2);
+
+    if (w.pos == NULL) {
+        buf[0] = '\0';
+        return -1;
+    }
+    *w.pos = '\0';
+    return w.pos - buf;
+}
+
+int callframe_stats_bin(long consoleid, const callframe_stats_t *stats, uint8_t *buf, size_t size) {
+    if (buf == NULL || size < CALLFRAME_STATS_LEN) return -1;
+
+    memset(buf, 0, 4);
+    buf[CALLFRAME_OFS_MAGIC]   = CALLFRAME_BIN_MAGIC;
+    buf[CALLFRAME_OFS_VERSION] = CALLFRAME_BIN_VERSION;
+    buf[CALLFRAME_OFS_TYPE]    = CALLFRAME_TYPE_STATS;
+    put_u32(&buf[4], (uint32_t)consoleid);
+    put_u32(&buf[8], stats->acked);
+    put_u32(&buf[12], stats->retransmits);
+    put_u32(&buf[16], stats->expired);
+    for (int i = 0; i < CALLFRAME_HIST_BUCKETS; i++) {
+        put_u32(&buf[20 + 4 * i], stats->hist[i]);
+    }
+    return CALLFRAME_STATS_LEN;
+}
+
+int callframe_stats_decode(const uint8_t *buf, size_t len, uint32_t *consoleid, callframe_stats_t *out) {
+    if (len < CALLFRAME_OFS_TYPE + 1) return CALLFRAME_ERR_SHORT;
+    if (buf[CALLFRAME_OFS_MAGIC] != CALLFRAME_BIN_MAGIC) return CALLFRAME_ERR_MAGIC;
+    if (buf[CALLFRAME_OFS_VERSION] != CALLFRAME_BIN_VERSION) return CALLFRAME_ERR_VERSION;
+    if (buf[CALLFRAME_OFS_TYPE] != CALLFRAME_TYPE_STATS) return CALLFRAME_ERR_TYPE;
+    if (len < CALLFRAME_STATS_LEN) return CALLFRAME_ERR_SHORT;
+
+    *consoleid       = get_u32(&buf[4]);
+    out->acked       = get_u32(&buf[8]);
+    out->retransmits = get_u32(&buf[12]);
+    out->expired     = get_u32(&buf[16]);
+    for (int i = 0; i < CALLFRAME_HIST_BUCKETS; i++) {
+        out->hist[i] = get_u32(&buf[20 + 4 * i]);
+    }
+    return CALLFRAME_STATS_LEN;
+}
@@ -0,0 +1,191 @@
+#ifndef _CALLFRAME_H_
+#define _CALLFRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// -----------------------------------------------------------
+//    Serialisation of the frames sent to the backend
+// -----------------------------------------------------------
+//
+// Plain C without ESP-IDF dependencies. Frames are written
+// straight into a buffer owned by the caller, nothing is
+// allocated on the heap.
+//
+// -----------------------------------------------------------
+
+#define CALLFRAME_CALLS     3
+#define CALLFRAME_JSON_MAX  512     // Fits the longest statuses and department ids in use
+
+typedef struct {
+    long        consoleid;
+    const char *department;                 // Department id, NULL is sent as "Undefined"
+    uint8_t     active;                     // Bit n set if call n+1 is active
+    const char *status[CALLFRAME_CALLS];    // Status set for each call, NULL is sent as "Undefined"
+    int32_t     oldcall;                    // Age in ms of a replayed event, CALLFRAME_LIVE otherwise
+    uint16_t    seq;                        // Sequence number acked by the server, 0 if not acked
+} callframe_t;
+
+#define CALLFRAME_LIVE      -1      // Current state, sent as "oldcall":""
+
+// Writes the JSON text frame, NUL terminated, in the same layout as
+// cJSON_PrintUnformatted() of the former cJSON tree:
+//   {"consoleid":1,"department":"2","call1":"Red","call2":"","call3":"","oldcall":""}
+// A replayed event carries its age, "oldcall":"1520" happened 1.52 s before
+// the frame was sent. Frames to be acked end with ,"seq":17 after "oldcall".
+// Returns the length without the terminator, -1 if 'size' is too small.
+int callframe_json(const callframe_t *frame, char *buf, size_t size);
+
+
+// -----------------------------------------------------------
+//    Binary frame, sent with esp_websocket_client_send_bin()
+// -----------------------------------------------------------
+//
+// Fixed layout, multi-byte fields little endian:
+//
+//   Offset  Size  Field
+//   0       1     Magic, CALLFRAME_BIN_MAGIC
+//   1       1     Version, CALLFRAME_BIN_VERSION
+//   2       1     Frame type, CALLFRAME_TYPE_*
+//   3       1     Flags, reserved, 0
+//   4       4     Console id
+//   8       2     Department id, CALLFRAME_DEPT_UNDEFINED if not set
+//   10      1     Active calls, bit n set if call n+1 is active
+//   11      3     Status of call 1..3, callframe_status_t
+//   14      2     Sequence number, 0 if not acked
+//
+// A replayed event (CALLFRAME_TYPE_OLDCALL) has the same layout
+// followed by:
+//
+//   16      4     Age of the event in ms when the frame was sent
+//
+// Several frames may be sent back to back in one message, the
+// length of each follows from its type.
+//
+// Decoders must reject frames of a version they do not know.
+//
+// -----------------------------------------------------------
+
+#define CALLFRAME_BIN_MAGIC     0xA5
+#define CALLFRAME_BIN_VERSION   1
+#define CALLFRAME_BIN_LEN       16
+#define CALLFRAME_BIN_OLDCALL_LEN 20
+
+#define CALLFRAME_OFS_MAGIC     0
+#define CALLFRAME_OFS_VERSION   1
+#define CALLFRAME_OFS_TYPE      2
+#define CALLFRAME_OFS_FLAGS     3
+#define CALLFRAME_OFS_CONSOLE   4
+#define CALLFRAME_OFS_DEPT      8
+#define CALLFRAME_OFS_ACTIVE    10
+#define CALLFRAME_OFS_STATUS    11
+#define CALLFRAME_OFS_SEQ       14
+#define CALLFRAME_OFS_AGE       16
+
+#define CALLFRAME_TYPE_STATE    1       // Current state of the calls
+#define CALLFRAME_TYPE_OLDCALL  2       // Replayed event, sent late
+#define CALLFRAME_DEPT_UNDEFINED 0xFFFF
+
+// Decoding errors
+#define CALLFRAME_ERR_SHORT     -1
+#define CALLFRAME_ERR_MAGIC     -2
+#define CALLFRAME_ERR_VERSION   -3
+#define CALLFRAME_ERR_TYPE      -4
+
+typedef enum {
+    CALLFRAME_STATUS_UNDEFINED = 0,
+    CALLFRAME_STATUS_RED       = 1,
+    CALLFRAME_STATUS_YELLOW    = 2,
+    CALLFRAME_STATUS_GREEN     = 3,
+} callframe_status_t;
+
+typedef struct {
+    uint8_t  version;
+    uint8_t  type;
+    uint8_t  flags;
+    uint32_t consoleid;
+    uint16_t department;
+    uint8_t  active;
+    uint8_t  status[CALLFRAME_CALLS];
+    int32_t  oldcall;       // Age in ms, CALLFRAME_LIVE for a state frame
+    uint16_t seq;
+} callframe_bin_t;
+
+// Maps the "Red"/"Yellow"/"Green" catalog strings to the enum and back
+callframe_status_t callframe_status(const char *status);
+const char *callframe_status_name(callframe_status_t status);
+
+// Writes the binary frame, a CALLFRAME_TYPE_OLDCALL frame if 'oldcall' is set.
+// Returns the frame length, -1 if 'size' is too small.
+int callframe_bin(const callframe_t *frame, uint8_t *buf, size_t size);
+
+// Reference decoder, returns the frame length or a CALLFRAME_ERR_* code
+int callframe_bin_decode(const uint8_t *buf, size_t len, callframe_bin_t *out);
+
+
+// -----------------------------------------------------------
+//    Acknowledgements, server to console
+// -----------------------------------------------------------
+//
+// The server acks the highest sequence number it received in
+// order, which acks every frame up to it:
+//
+//   JSON     {"ack":17}
+//   Binary   Magic, version, CALLFRAME_TYPE_ACK, flags, then the
+//            sequence number as u16 at offset 4
+//
+// Sequence numbers wrap from 65535 to 1.
+//
+// -----------------------------------------------------------
+
+#define CALLFRAME_TYPE_ACK      3
+#define CALLFRAME_ACK_LEN       6
+#define CALLFRAME_OFS_ACK_SEQ   4
+
+// Parse an ack message, return 0 and the sequence number in 'seq', or -1
+int callframe_ack_json(const char *buf, size_t len, uint16_t *seq);
+int callframe_ack_bin(const uint8_t *buf, size_t len, uint16_t *seq);
+
+// Writes a binary ack, for the server side and tests. Returns CALLFRAME_ACK_LEN.
+int callframe_ack_bin_encode(uint16_t seq, uint8_t *buf, size_t size);
+
+
+// -----------------------------------------------------------
+//    Statistics frame, console to server
+// -----------------------------------------------------------
+//
+// Press to ack latency of the acked frames in fixed buckets,
+// bucket n counts latencies up to CALLFRAME_HIST_BOUNDS[n] ms,
+// the last one everything slower.
+//
+//   JSON     {"consoleid":1,"stats":{"acked":9,"retransmits":1,"expired":0,
+//             "hist_ms":[50,100,...],"hist":[3,5,...]}}
+//   Binary   Magic, version, CALLFRAME_TYPE_STATS, flags, then u32
+//            console id, acked, retransmits, expired and one u32
+//            per bucket
+//
+// -----------------------------------------------------------
+
+#define CALLFRAME_TYPE_STATS    4
+#define CALLFRAME_HIST_BUCKETS  10
+#define CALLFRAME_HIST_BOUNDS   {50, 100, 200, 300, 500, 750, 1000, 2000, 5000}
+#define CALLFRAME_STATS_LEN     (4 + 4 * (4 + CALLFRAME_HIST_BUCKETS))
+
+typedef struct {
+    uint32_t acked;                         // Frames acked
+    uint32_t retransmits;                   // Frames sent again, not acked in time
+    uint32_t expired;                       // Frames given up on, never acked
+    uint32_t hist[CALLFRAME_HIST_BUCKETS];  // Press to ack latency
+} callframe_stats_t;
+
+// Bucket of a latency in ms
+int callframe_hist_bucket(uint32_t latency_ms);
+
+// Write the stats frame, return its length or -1 if 'size' is too small
+int callframe_stats_json(long consoleid, const callframe_stats_t *stats, char *buf, size_t size);
+int callframe_stats_bin(long consoleid, const callframe_stats_t *stats, uint8_t *buf, size_t size);
+
+// Reference decoder, returns the frame length or a CALLFRAME_ERR_* code
+int callframe_stats_decode(const uint8_t *buf, size_t len, uint32_t *consoleid, callframe_stats_t *out);
+
+#endif
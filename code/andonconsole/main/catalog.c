@@ -0,0 +1,92 @@
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "cJSON.h"
+#include "catalog.h"
+
+static const char *TAG_CATALOG = "Catalog";
+
+// Copies a string member, returns false if it is missing
+static bool get_field(const cJSON *item, const char *key, char *out) {
+    const cJSON *value = cJSON_GetObjectItem(item, key);
+    if (!cJSON_IsString(value)) return false;
+
+    strlcpy(out, value->valuestring, CATALOG_FIELD_LEN);
+    return true;
+}
+
+static bool parse_cmd(const cJSON *item, catalog_cmd_t *cmd) {
+    char kind[8];
+    char op[8];
+
+    memset(cmd, 0, sizeof(*cmd));
+    const cJSON *catalog = cJSON_GetObjectItem(item, "catalog");
+    const cJSON *operation = cJSON_GetObjectItem(item, "op");
+    if (!cJSON_IsString(catalog) || !cJSON_IsString(operation)) return false;
+    strlcpy(kind, catalog->valuestring, sizeof(kind));
+    strlcpy(op, operation->valuestring, sizeof(op));
+
+    if (strcmp(op, "add") == 0) cmd->op = CATALOG_ADD;
+    else if (strcmp(op, "update") == 0) cmd->op = CATALOG_UPDATE;
+    else if (strcmp(op, "remove") == 0) cmd->op = CATALOG_REMOVE;
+    else return false;
+
+    if (strcmp(kind, "calls") == 0) {
+        cmd->kind = CATALOG_CALLS;
+        if (!get_field(item, "mancalldesc", cmd->key)) return false;
+        if (cmd->op == CATALOG_REMOVE) return true;
+        return get_field(item, "status", cmd->status) && get_field(item, "mancallto", cmd->name);
+    }
+
+    if (strcmp(kind, "depts") == 0) {
+        cmd->kind = CATALOG_DEPTS;
+        if (!get_field(item, "deptid", cmd->key)) return false;
+        if (cmd->op == CATALOG_REMOVE) return true;
+        return get_field(item, "deptname", cmd->name);
+    }
+    return false;
+}
+
+catalog_batch_t *catalog_parse(const char *buf, size_t len) {
+    // Cheap check first, most messages are acks
+    if (len < 2 || (buf[0] != '{' && buf[0] != '[')) return NULL;
+
+    cJSON *json = cJSON_ParseWithLength(buf, len);
+    if (json == NULL) return NULL;
+
+    int items = 0;
+    if (cJSON_IsArray(json)) items = cJSON_GetArraySize(json);
+    else if (cJSON_IsObject(json) && cJSON_GetObjectItem(json, "catalog") != NULL) items = 1;
+    if (items == 0) {
+        cJSON_Delete(json);
+        return NULL;
+    }
+
+    catalog_batch_t *batch = malloc(sizeof(catalog_batch_t) + items * sizeof(catalog_cmd_t));
+    if (batch == NULL) {
+        ESP_LOGE(TAG_CATALOG, "No memory for %d catalog commands", items);
+        cJSON_Delete(json);
+        return NULL;
+    }
+
+    batch->count = 0;
+    if (cJSON_IsArray(json)) {
+        const cJSON *item;
+        cJSON_ArrayForEach(item, json) {
+            if (parse_cmd(item, &batch->cmds[batch->count])) batch->count++;
+            else ESP_LOGW(TAG_CATALOG, "Malformed catalog command skipped");
+        }
+    } else if (parse_cmd(json, &batch->cmds[0])) {
+        batch->count = 1;
+    } else {
+        ESP_LOGW(TAG_CATALOG, "Malformed catalog update");
+    }
+
+    cJSON_Delete(json);
+    if (batch->count == 0) {
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
@@ -0,0 +1,57 @@
+#ifndef _CATALOG_H_
+#define _CATALOG_H_
+
+#include <stddef.h>
+
+// -----------------------------------------------------------
+//    Catalog updates pushed by the server
+// -----------------------------------------------------------
+//
+// Calls and departments are changed incrementally over the
+// websocket instead of fetched over HTTP. A text message holds
+// one command, or an array of them:
+//
+//   {"catalog":"calls","op":"add","status":"Red",
+//    "mancalldesc":"Motor jam","mancallto":"Maintenance"}
+//   {"catalog":"depts","op":"update","deptid":"2","deptname":"Assembly"}
+//   {"catalog":"calls","op":"remove","mancalldesc":"Motor jam"}
+//
+// Calls are identified by "mancalldesc", departments by
+// "deptid". "add" and "update" both insert or replace.
+//
+// -----------------------------------------------------------
+
+#define CATALOG_FIELD_LEN   48      // Longer strings are truncated
+#define CATALOG_MESSAGE_MAX 32768   // Longest message put back together from websocket parts, in bytes
+
+typedef enum {
+    CATALOG_CALLS,
+    CATALOG_DEPTS,
+} catalog_kind_t;
+
+typedef enum {
+    CATALOG_ADD,
+    CATALOG_UPDATE,
+    CATALOG_REMOVE,
+} catalog_op_t;
+
+typedef struct {
+    catalog_kind_t kind;
+    catalog_op_t   op;
+    char key[CATALOG_FIELD_LEN];        // mancalldesc or deptid
+    char status[CATALOG_FIELD_LEN];     // Calls only
+    char name[CATALOG_FIELD_LEN];       // mancallto, or deptname
+} catalog_cmd_t;
+
+// All the commands of one message, applied together
+typedef struct {
+    int count;
+    catalog_cmd_t cmds[];
+} catalog_batch_t;
+
+// Parses a text message into a batch of all its commands, allocated with
+// malloc(). Returns NULL if the message is not a catalog update, or there
+// was no memory for the batch.
+catalog_batch_t *catalog_parse(const char *buf, size_t len);
+
+#endif
@@ -0,0 +1,183 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "journal.h"
+
+static const char *TAG_JOURNAL = "Journal";
+
+#define JOURNAL_SUBTYPE     0x40        // Custom data subtype, see partitions.csv
+#define JOURNAL_SECTOR      4096
+#define SECTOR_ENTRIES      (JOURNAL_SECTOR / sizeof(journal_entry_t))
+
+_Static_assert(sizeof(journal_entry_t) == 64, "journal entries must divide a flash sector");
+_Static_assert(JOURNAL_STRINGS <= 256, "string indexes are one byte");
+
+// Strings of the entries, index 0 is JOURNAL_UNDEFINED. Slots are only
+// ever appended, a string already given out does not change.
+static char strings[JOURNAL_STRINGS][JOURNAL_FIELD_LEN];
+static uint32_t string_count = 1;
+static SemaphoreHandle_t strings_lock = NULL;   // Appends, from the input and network tasks
+static bool strings_full = false;
+
+// RAM ring, newest events
+static journal_entry_t ram[JOURNAL_RAM_ENTRIES];
+static uint32_t ram_head = 0;           // Oldest entry
+static uint32_t ram_count = 0;
+
+// Flash ring, oldest events. One sector is kept free so erasing the
+// sector ahead of the write position never loses an unsent entry.
+static const esp_partition_t *partition = NULL;
+static uint32_t flash_slots = 0;
+static uint32_t flash_head = 0;         // Slot of the oldest entry
+static uint32_t flash_count = 0;
+
+static uint32_t dropped = 0;
+
+void journal_init(void) {
+    strings_lock = xSemaphoreCreateMutex();
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_SUBTYPE, "journal");
+    if (partition == NULL) {
+        ESP_LOGW(TAG_JOURNAL, "No journal partition, backlog limited to %d events", JOURNAL_RAM_ENTRIES);
+        return;
+    }
+
+    // Sectors are erased as they are reached, entries of a previous boot are ignored
+    flash_slots = partition->size / sizeof(journal_entry_t);
+    ESP_LOGI(TAG_JOURNAL, "Journal partition, %lu events",
+             (unsigned long)(flash_slots - SECTOR_ENTRIES));
+}
+
+static bool flash_append(const journal_entry_t *entry) {
+    if (partition == NULL || flash_count >= flash_slots - SECTOR_ENTRIES) return false;
+
+    uint32_t slot = (flash_head + flash_count) % flash_slots;
+    size_t offset = slot * sizeof(journal_entry_t);
+
+    if (offset % JOURNAL_SECTOR == 0 &&
+        esp_partition_erase_range(partition, offset, JOURNAL_SECTOR) != ESP_OK) {
+        ESP_LOGE(TAG_JOURNAL, "Erasing sector at 0x%x failed", (unsigned)offset);
+        return false;
+    }
+    if (esp_partition_write(partition, offset, entry, sizeof(*entry)) != ESP_OK) {
+        ESP_LOGE(TAG_JOURNAL, "Writing entry at 0x%x failed", (unsigned)offset);
+        return false;
+    }
+    flash_count++;
+    return true;
+}
+
+// Index of 'str' in the string table, added if not there yet
+static uint8_t string_index(const char *str) {
+    if (str == NULL || str[0] == '\0') return JOURNAL_UNDEFINED;
+
+    xSemaphoreTake(strings_lock, portMAX_DELAY);
+    uint32_t i;
+    for (i = 1; i < string_count; i++) {
+        if (strncmp(strings[i], str, JOURNAL_FIELD_LEN - 1) == 0) break;
+    }
+    if (i == string_count) {
+        if (i == JOURNAL_STRINGS) {
+            if (!strings_full) ESP_LOGE(TAG_JOURNAL, "String table full, %s and later new strings sent as undefined", str);
+            strings_full = true;
+            i = JOURNAL_UNDEFINED;
+        } else {
+            // Cut like the catalog cuts its fields
+            strlcpy(strings[i], str, JOURNAL_FIELD_LEN);
+            string_count = i + 1;
+        }
+    }
+    xSemaphoreGive(strings_lock);
+    return i;
+}
+
+void journal_entry(const callframe_t *frame, int64_t timestamp, journal_entry_t *entry) {
+    *entry = (journal_entry_t) {
+        .timestamp  = timestamp,
+        .seq        = frame->seq,
+        .active     = frame->active,
+        .department = string_index(frame->department),
+    };
+    for (int i = 0; i < CALLFRAME_CALLS; i++) {
+        entry->status[i] = string_index(frame->status[i]);
+    }
+}
+
+bool journal_push(const journal_entry_t *entry) {
+    // Full RAM ring, the oldest entry moves to flash to make room
+    if (ram_count == JOURNAL_RAM_ENTRIES) {
+        if (!flash_append(&ram[ram_head])) {
+            dropped++;
+            return false;
+        }
+        ram_head = (ram_head + 1) % JOURNAL_RAM_ENTRIES;
+        ram_count--;
+    }
+
+    ram[(ram_head + ram_count) % JOURNAL_RAM_ENTRIES] = *entry;
+    ram_count++;
+    return true;
+}
+
+int journal_peek(journal_entry_t *out, int max) {
+    uint32_t n = 0;
+
+    // Flash first, read in contiguous runs
+    while (n < (uint32_t)max && n < flash_count) {
+        uint32_t slot = (flash_head + n) % flash_slots;
+        uint32_t run = flash_slots - slot;
+        if (run > flash_count - n) run = flash_count - n;
+        if (run > (uint32_t)max - n) run = max - n;
+
+        if (esp_partition_read(partition, slot * sizeof(journal_entry_t), &out[n],
+                               run * sizeof(journal_entry_t)) != ESP_OK) {
+            ESP_LOGE(TAG_JOURNAL, "Reading %lu entries failed", (unsigned long)run);
+            return n;
+        }
+        n += run;
+    }
+
+    for (uint32_t i = 0; n < (uint32_t)max && i < ram_count; i++) {
+        out[n++] = ram[(ram_head + i) % JOURNAL_RAM_ENTRIES];
+    }
+    return n;
+}
+
+void journal_commit(int count) {
+    uint32_t left = count;
+    uint32_t n = (left < flash_count) ? left : flash_count;
+    if (n) {
+        flash_head = (flash_head + n) % flash_slots;
+        flash_count -= n;
+        left -= n;
+    }
+
+    n = (left < ram_count) ? left : ram_count;
+    ram_head = (ram_head + n) % JOURNAL_RAM_ENTRIES;
+    ram_count -= n;
+}
+
+uint32_t journal_count(void) {
+    return flash_count + ram_count;
+}
+
+uint32_t journal_dropped(void) {
+    return dropped;
+}
+
+void journal_callframe(const journal_entry_t *entry, long consoleid, int64_t now, callframe_t *frame) {
+    int64_t age_ms = (now - entry->timestamp) / 1000;
+
+    *frame = (callframe_t) {
+        .consoleid  = consoleid,
+        .department = entry->department ? strings[entry->department] : NULL,
+        .active     = entry->active,
+        .oldcall    = (age_ms > INT32_MAX) ? INT32_MAX : (int32_t)age_ms,
+        .seq        = entry->seq,
+    };
+    for (int i = 0; i < CALLFRAME_CALLS; i++) {
+        frame->status[i] = entry->status[i] ? strings[entry->status[i]] : NULL;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "callframe.h"
+#include "catalog.h"
+
+// -----------------------------------------------------------
+//    Outbound journal, call events not yet sent
+// -----------------------------------------------------------
+//
+// Events that could not be sent are kept in order, first in a
+// RAM ring and, once that is full, in the "journal" flash
+// partition (see partitions.csv). The oldest events are moved
+// to flash so the order is always flash, then RAM.
+//
+// Timestamps are esp_timer_get_time() microseconds, so the
+// backlog only has a meaning within one boot. Entries left in
+// flash by a previous boot are discarded at start-up.
+//
+// Department ids and statuses are kept once in a table of
+// strings, entries only hold their index. Indexes are given
+// out as strings are first seen, so like the timestamps they
+// only have a meaning within one boot.
+//
+// Not thread safe, only used from the task sending telemetry.
+// journal_entry() is the exception, it is also called by the
+// input task.
+//
+// -----------------------------------------------------------
+
+#define JOURNAL_RAM_ENTRIES     32
+#define JOURNAL_STRINGS         64                  // Distinct department ids and statuses per boot
+#define JOURNAL_FIELD_LEN       CATALOG_FIELD_LEN   // Longer strings are truncated
+#define JOURNAL_UNDEFINED       0                   // String index of an undefined field
+
+typedef struct {
+    int64_t  timestamp;                             // When the event happened
+    uint16_t seq;                                   // Sequence number, 0 if not acked
+    uint8_t  active;                                // Bit n set if call n+1 is active
+    uint8_t  department;                            // String index of the department id
+    uint8_t  status[CALLFRAME_CALLS];               // String index of each status
+    uint8_t  reserved[49];                          // Pads an entry to 64 bytes
+} journal_entry_t;
+
+// Finds the journal partition, the journal is RAM only without it.
+// Called before any task uses the journal.
+void journal_init(void);
+
+// Fills an entry with the state in 'frame', as of 'timestamp'. Strings
+// not seen before are added to the table; once it is full they are
+// logged and kept as undefined, the state itself is always kept.
+void journal_entry(const callframe_t *frame, int64_t timestamp, journal_entry_t *entry);
+
+// Appends an entry, returns false if both the RAM ring and flash are full
+bool journal_push(const journal_entry_t *entry);
+
+// Copies up to 'max' of the oldest entries without removing them.
+// Returns the number of entries copied.
+int journal_peek(journal_entry_t *out, int max);
+
+// Removes the 'count' oldest entries, once they have been sent
+void journal_commit(int count);
+
+// Entries waiting, and entries lost because the journal was full
+uint32_t journal_count(void);
+uint32_t journal_dropped(void);
+
+// Frame of an entry, 'oldcall' set to its age at 'now'
+void journal_callframe(const journal_entry_t *entry, long consoleid, int64_t now, callframe_t *frame);
+
+#endif
@@ -0,0 +1,437 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "journal.h"
+#include "telemetry.h"
+
+static const char *TAG_SOCK = "WebSocket";
+
+static esp_websocket_client_handle_t ws_client = NULL;
+static long console_id = 0;
+
+// Frames are serialised into static buffers, nothing allocated per message
+static char frame_buf[CALLFRAME_JSON_MAX];
+static char sent_buf[CALLFRAME_JSON_MAX];      // Last frame queued
+static int  sent_len = -1;                      // -1: nothing queued yet
+static int64_t sent_time = 0;                   // Last message sent
+static int64_t failed_time = 0;                 // 0: last attempt succeeded
+
+// Message being sent, several frames each
+static char batch_buf[TELEMETRY_BATCH_MAX];
+static journal_entry_t batch_entries[TELEMETRY_BATCH_EVENTS];
+
+// Live states waiting for the batch window to pass. Changes carry a
+// sequence number, heartbeats do not and are never journaled.
+static journal_entry_t pending[TELEMETRY_BATCH_EVENTS];
+static int pending_count = 0;
+static int pending_bytes = 0;
+static int64_t pending_since = 0;
+
+// Changes sent and not acked yet, oldest first
+static journal_entry_t inflight[TELEMETRY_INFLIGHT];
+static int64_t inflight_sent[TELEMETRY_INFLIGHT];
+static uint8_t inflight_tries[TELEMETRY_INFLIGHT];
+static int inflight_head = 0;
+static int inflight_count = 0;
+static uint16_t next_seq = 1;
+static bool acks_seen = false;                  // Nothing is retransmitted to a server not acking
+
+// Acks, stamped on arrival by the websocket task
+typedef struct {
+    uint16_t seq;
+    int64_t  time;
+} ack_t;
+
+static QueueHandle_t ack_queue = NULL;
+static int64_t stats_time = 0;                  // Last stats frame sent
+
+static volatile bool resync = false;
+static telemetry_stats_t stats;
+
+void telemetry_init(void) {
+    ack_queue = xQueueCreate(TELEMETRY_ACK_QUEUE_LEN, sizeof(ack_t));
+}
+
+void telemetry_set_client(esp_websocket_client_handle_t client) {
+    ws_client = client;
+}
+
+static int encode_frame(const callframe_t *frame) {
+#if defined(WIRE_FORMAT_BINARY)
+    return callframe_bin(frame, (uint8_t *)frame_buf, sizeof(frame_buf));
+#else
+    return callframe_json(frame, frame_buf, sizeof(frame_buf));
+#endif
+}
+
+// Sends an encoded message, returns true on success
+static bool send_message(const char *buf, int len) {
+    if (ws_client == NULL || !esp_websocket_client_is_connected(ws_client)) {
+        ESP_LOGW(TAG_SOCK, "WebSocket client is not connected");
+        stats.failed++;
+        failed_time = esp_timer_get_time();
+        return false;
+    }
+
+#if defined(WIRE_FORMAT_BINARY)
+    int sent = esp_websocket_client_send_bin(ws_client, buf, len, portMAX_DELAY);
+#else
+    int sent = esp_websocket_client_send_text(ws_client, buf, len, portMAX_DELAY);
+#endif
+    if (sent != len) {
+        stats.failed++;
+        failed_time = esp_timer_get_time();
+        return false;
+    }
+
+    stats.messages++;
+    stats.bytes += len;
+    sent_time = esp_timer_get_time();
+    failed_time = 0;
+    return true;
+}
+
+// Nothing but retries while sends are failing
+static bool retry_due(int64_t now) {
+    return failed_time == 0 || now - failed_time >= TELEMETRY_RETRY_MS * 1000LL;
+}
+
+// Packs as many entries as fit into batch_buf, a JSON array of frames or
+// binary frames back to back. Live states are sent as current, a lone one
+// as a plain JSON frame. Returns the message length and the number of
+// entries packed in 'packed'.
+static int pack_batch(const journal_entry_t *entries, int count, bool live, int *packed) {
+    int64_t now = esp_timer_get_time();
+    bool array = !live || count > 1;
+    callframe_t frame;
+    int len = 0;
+    int n;
+
+#if defined(WIRE_FORMAT_BINARY)
+    array = false;
+#endif
+    if (array) batch_buf[len++] = '[';
+
+    for (n = 0; n < count; n++) {
+        journal_callframe(&entries[n], console_id, now, &frame);
+        if (live) frame.oldcall = CALLFRAME_LIVE;
+#if defined(WIRE_FORMAT_BINARY)
+        int ret = callframe_bin(&frame, (uint8_t *)&batch_buf[len], sizeof(batch_buf) - len);
+#else
+        if (n > 0) batch_buf[len++] = ',';
+        // Room kept for the closing bracket
+        int ret = callframe_json(&frame, &batch_buf[len], sizeof(batch_buf) - len - 1);
+#endif
+        if (ret < 0) {
+            if (n > 0 && array) len--;
+            break;
+        }
+        len += ret;
+    }
+
+    if (array) batch_buf[len++] = ']';
+#if !defined(WIRE_FORMAT_BINARY)
+    batch_buf[len] = '\0';
+#endif
+
+    *packed = n;
+    return len;
+}
+
+
+// --------------------------------------------------------
+//    Acks and retransmits
+// --------------------------------------------------------
+
+static uint16_t take_seq(void) {
+    uint16_t seq = next_seq;
+    next_seq = (next_seq == 0xFFFF) ? 1 : next_seq + 1;
+    return seq;
+}
+
+// Tracks the changes just sent until they are acked
+static void track_sent(const journal_entry_t *entries, int count, int64_t now) {
+    for (int i = 0; i < count; i++) {
+        if (entries[i].seq == 0) continue;
+
+        // Window full, the oldest change is given up on
+        if (inflight_count == TELEMETRY_INFLIGHT) {
+            inflight_head = (inflight_head + 1) % TELEMETRY_INFLIGHT;
+            inflight_count--;
+            stats.acks.expired++;
+        }
+
+        int slot = (inflight_head + inflight_count) % TELEMETRY_INFLIGHT;
+        inflight[slot] = entries[i];
+        inflight_sent[slot] = now;
+        inflight_tries[slot] = 0;
+        inflight_count++;
+    }
+}
+
+// An ack covers every change up to its sequence number, in wrapping order
+static void process_acks(void) {
+    ack_t ack;
+
+    while (ack_queue != NULL && xQueueReceive(ack_queue, &ack, 0) == pdTRUE) {
+        acks_seen = true;
+
+        while (inflight_count && (int16_t)(ack.seq - inflight[inflight_head].seq) >= 0) {
+            int64_t latency_ms = (ack.time - inflight[inflight_head].timestamp) / 1000;
+            stats.acks.hist[callframe_hist_bucket(latency_ms)]++;
+            stats.acks.acked++;
+
+            inflight_head = (inflight_head + 1) % TELEMETRY_INFLIGHT;
+            inflight_count--;
+        }
+    }
+}
+
+// Sends the changes not acked within TELEMETRY_ACK_TIMEOUT_MS again, as
+// replayed frames with their original sequence numbers
+static void retransmit(int64_t now) {
+    int slots[TELEMETRY_BATCH_EVENTS];
+    int count = 0;
+
+    // Given up after TELEMETRY_MAX_TRIES, once it is the oldest
+    while (inflight_count && inflight_tries[inflight_head] >= TELEMETRY_MAX_TRIES &&
+           now - inflight_sent[inflight_head] >= TELEMETRY_ACK_TIMEOUT_MS * 1000LL) {
+        inflight_head = (inflight_head + 1) % TELEMETRY_INFLIGHT;
+        inflight_count--;
+        stats.acks.expired++;
+    }
+
+    for (int i = 0; i < inflight_count && count < TELEMETRY_BATCH_EVENTS; i++) {
+        int slot = (inflight_head + i) % TELEMETRY_INFLIGHT;
+        if (inflight_tries[slot] < TELEMETRY_MAX_TRIES &&
+            now - inflight_sent[slot] >= TELEMETRY_ACK_TIMEOUT_MS * 1000LL) {
+            batch_entries[count] = inflight[slot];
+            slots[count++] = slot;
+        }
+    }
+    if (count == 0) return;
+
+    int packed;
+    int len = pack_batch(batch_entries, count, false, &packed);
+    if (!send_message(batch_buf, len)) return;
+
+    for (int i = 0; i < packed; i++) {
+        inflight_sent[slots[i]] = now;
+        inflight_tries[slots[i]]++;
+    }
+    stats.acks.retransmits += packed;
+    ESP_LOGW(TAG_SOCK, "Retransmitted %d unacked events", packed);
+}
+
+// When the next retransmit is due, 0 if none
+static int64_t retransmit_due(void) {
+    int64_t due = 0;
+
+    if (!acks_seen) return 0;
+    for (int i = 0; i < inflight_count; i++) {
+        int slot = (inflight_head + i) % TELEMETRY_INFLIGHT;
+        int64_t t = inflight_sent[slot] + TELEMETRY_ACK_TIMEOUT_MS * 1000LL;
+        if (due == 0 || t < due) due = t;
+    }
+    return due;
+}
+
+static void send_stats(int64_t now) {
+#if defined(WIRE_FORMAT_BINARY)
+    int len = callframe_stats_bin(console_id, &stats.acks, (uint8_t *)batch_buf, sizeof(batch_buf));
+#else
+    int len = callframe_stats_json(console_id, &stats.acks, batch_buf, sizeof(batch_buf));
+#endif
+    if (len > 0 && send_message(batch_buf, len)) stats_time = now;
+}
+
+
+// --------------------------------------------------------
+//    Sending
+// --------------------------------------------------------
+
+// Replays the journal, oldest first. Returns true once it is empty.
+static bool replay_journal(void) {
+    while (journal_count()) {
+        int count = journal_peek(batch_entries, TELEMETRY_BATCH_EVENTS);
+        if (count == 0) return false;
+
+        int packed;
+        int len = pack_batch(batch_entries, count, false, &packed);
+        if (!send_message(batch_buf, len)) return false;
+
+        journal_commit(packed);
+        track_sent(batch_entries, packed, esp_timer_get_time());
+        stats.replayed += packed;
+        ESP_LOGI(TAG_SOCK, "Replayed %d events, %lu left", packed, (unsigned long)journal_count());
+    }
+    return true;
+}
+
+// Sends the pending states, after the backlog so the server gets the
+// events in order. Changes that cannot be sent go to the journal.
+static void flush_pending(void) {
+    if (pending_count == 0) return;
+
+    int packed = 0;
+    int len = 0;
+    bool sent = replay_journal();
+    if (sent) {
+        len = pack_batch(pending, pending_count, true, &packed);
+        sent = send_message(batch_buf, len);
+    }
+
+    if (sent) {
+        int64_t now = esp_timer_get_time();
+        track_sent(pending, packed, now);
+        stats.events += packed;
+        for (int i = 0; i < packed; i++) {
+            uint32_t latency = now - pending[i].timestamp;
+            stats.latency_us += latency;
+            if (latency > stats.latency_max_us) stats.latency_max_us = latency;
+        }
+#if defined(WIRE_FORMAT_BINARY)
+        ESP_LOG_BUFFER_HEX(TAG_SOCK, batch_buf, len);
+#else
+        ESP_LOGI(TAG_SOCK, "Sent data: %s", batch_buf);
+#endif
+    } else {
+        for (int i = 0; i < pending_count; i++) {
+            if (pending[i].seq && journal_push(&pending[i])) stats.journaled++;
+        }
+    }
+
+    pending_count = 0;
+    pending_bytes = 0;
+}
+
+// True when nothing was sent for HEARTBEAT_S, or a retry is due
+static bool heartbeat_due(int64_t now) {
+    if (failed_time) return retry_due(now);
+    return now - sent_time >= HEARTBEAT_S * 1000000LL;
+}
+
+static void log_stats(void) {
+    ESP_LOGI(TAG_SOCK, "Heartbeat, %lu offered, %lu changes, %lu heartbeats, %lu suppressed (%lu%%), %lu failed, "
+             "%lu journaled, %lu replayed, %lu lost",
+             (unsigned long)stats.offered, (unsigned long)stats.changes, (unsigned long)stats.heartbeats,
+             (unsigned long)stats.suppressed, (unsigned long)(100ULL * stats.suppressed / stats.offered),
+             (unsigned long)stats.failed, (unsigned long)stats.journaled, (unsigned long)stats.replayed,
+             (unsigned long)journal_dropped());
+
+    if (stats.events) {
+        ESP_LOGI(TAG_SOCK, "%lu messages, %lu bytes, %lu live events, latency mean %lu us, max %lu us",
+                 (unsigned long)stats.messages, (unsigned long)stats.bytes, (unsigned long)stats.events,
+                 (unsigned long)(stats.latency_us / stats.events), (unsigned long)stats.latency_max_us);
+    }
+
+    if (stats.acks.acked) {
+        uint32_t within = 0;
+        for (int i = 0; i <= callframe_hist_bucket(TELEMETRY_SLA_MS); i++) within += stats.acks.hist[i];
+        ESP_LOGI(TAG_SOCK, "%lu acked, %lu%% within %d ms, %lu retransmits, %lu expired, %d unacked",
+                 (unsigned long)stats.acks.acked, (unsigned long)(100ULL * within / stats.acks.acked),
+                 TELEMETRY_SLA_MS, (unsigned long)stats.acks.retransmits, (unsigned long)stats.acks.expired,
+                 inflight_count);
+    }
+}
+
+bool telemetry_offer(const callframe_t *frame, int64_t timestamp) {
+    int64_t now = esp_timer_get_time();
+    stats.offered++;
+    console_id = frame->consoleid;
+
+    int len = encode_frame(frame);
+    if (len < 0) {
+        ESP_LOGE(TAG_SOCK, "Frame does not fit in %d bytes", (int)sizeof(frame_buf));
+        stats.failed++;
+        return false;
+    }
+
+    // The encoded frame holds the active calls, department and statuses
+    bool differs = len != sent_len || memcmp(frame_buf, sent_buf, len) != 0;
+    bool changed = resync || differs;
+    bool heartbeat = !changed && pending_count == 0 && heartbeat_due(now);
+
+    if (!changed && !heartbeat) {
+        stats.suppressed++;
+        return false;
+    }
+
+    // Full batch, it goes out before this state is queued
+    if (pending_count == TELEMETRY_BATCH_EVENTS || pending_bytes + len + 1 > BATCH_BYTES) {
+        flush_pending();
+    }
+
+    if (pending_count == 0) pending_since = now;
+    journal_entry(frame, timestamp, &pending[pending_count]);
+    pending[pending_count].seq = differs ? take_seq() : 0;
+    pending_count++;
+    pending_bytes += len + 1;
+
+    resync = false;
+    memcpy(sent_buf, frame_buf, len);
+    sent_len = len;
+
+    if (changed) {
+        stats.changes++;
+    } else {
+        stats.heartbeats++;
+        log_stats();
+    }
+    return true;
+}
+
+void telemetry_poll(void) {
+    int64_t now = esp_timer_get_time();
+
+    process_acks();
+
+    if (pending_count && now - pending_since >= BATCH_WINDOW_MS * 1000LL) {
+        flush_pending();
+    }
+
+    if (!retry_due(now)) return;
+
+    int64_t due = retransmit_due();
+    if (due && now >= due) retransmit(now);
+
+    if (now - stats_time >= TELEMETRY_STATS_S * 1000000LL) send_stats(now);
+}
+
+void telemetry_ack(uint16_t seq) {
+    ack_t ack = {seq, esp_timer_get_time()};
+
+    // A later ack covers this one, dropped if the queue is full
+    if (ack_queue != NULL) xQueueSend(ack_queue, &ack, 0);
+}
+
+void telemetry_resync(void) {
+    resync = true;
+}
+
+uint32_t telemetry_wait_ms(void) {
+    int64_t due;
+
+    if (pending_count) due = pending_since + BATCH_WINDOW_MS * 1000LL;
+    else if (sent_len < 0) return 0;
+    // After a failed send retry sooner than the heartbeat, but do not spin
+    else if (failed_time) due = failed_time + TELEMETRY_RETRY_MS * 1000LL;
+    else {
+        due = sent_time + HEARTBEAT_S * 1000000LL;
+
+        int64_t retransmit = retransmit_due();
+        if (retransmit && retransmit < due) due = retransmit;
+
+        int64_t stats_due = stats_time + TELEMETRY_STATS_S * 1000000LL;
+        if (stats_due < due) due = stats_due;
+    }
+
+    int64_t remaining = due - esp_timer_get_time();
+    return (remaining > 0) ? (uint32_t)((remaining + 999) / 1000) : 0;
+}
+
+void telemetry_get_stats(telemetry_stats_t *out) {
+    *out = stats;
+}
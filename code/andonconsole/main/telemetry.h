@@ -0,0 +1,106 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_websocket_client.h"
+#include "callframe.h"
+
+// -----------------------------------------------------------
+//    Telemetry sent to the backend
+// -----------------------------------------------------------
+//
+// A state is only transmitted when it differs from the last
+// one sent (active calls, department or call statuses), plus a
+// heartbeat every HEARTBEAT_S seconds so the server can tell a
+// quiet console from a dead one.
+//
+// States are not sent one message each. They are collected for
+// BATCH_WINDOW_MS, or until BATCH_BYTES are pending, and go out
+// as one message: a JSON array of frames (a lone frame is sent
+// as is), or binary frames back to back.
+//
+// Changes that cannot be sent are kept in the journal (see
+// journal.h) and replayed in batches, oldest first, before the
+// next message goes out.
+//
+// Every change carries a sequence number the server acks (see
+// callframe.h). Press to ack latency goes into a histogram sent
+// in a stats frame every TELEMETRY_STATS_S. Changes not acked
+// within TELEMETRY_ACK_TIMEOUT_MS are sent again, once the
+// server has shown it acks at all.
+//
+// -----------------------------------------------------------
+
+#ifndef HEARTBEAT_S
+#define HEARTBEAT_S 30
+#endif
+
+#ifndef BATCH_WINDOW_MS
+#define BATCH_WINDOW_MS 20
+#endif
+
+#ifndef BATCH_BYTES
+#define BATCH_BYTES 1024
+#endif
+
+#define TELEMETRY_RETRY_MS      1000    // Retry period while sends are failing
+#define TELEMETRY_BATCH_EVENTS  16      // Events per message at most
+#define TELEMETRY_BATCH_MAX     2048    // Bytes per message at most
+
+#define TELEMETRY_INFLIGHT      32      // Changes sent and not acked yet
+#define TELEMETRY_ACK_TIMEOUT_MS 2000   // Retransmitted when not acked within
+#define TELEMETRY_MAX_TRIES     3       // Retransmits before a change is given up on
+#define TELEMETRY_ACK_QUEUE_LEN 8
+#define TELEMETRY_STATS_S       60      // Period of the stats frame
+#define TELEMETRY_SLA_MS        500     // Press to ack target, reported in the log
+
+_Static_assert(BATCH_BYTES + CALLFRAME_JSON_MAX <= TELEMETRY_BATCH_MAX, "BATCH_BYTES too large");
+
+typedef struct {
+    uint32_t offered;       // States handed to telemetry_offer()
+    uint32_t changes;       // Queued because the state changed
+    uint32_t heartbeats;    // Queued because nothing was sent for HEARTBEAT_S
+    uint32_t suppressed;    // Not queued, identical to the last state queued
+    uint32_t failed;        // Messages not sent, client disconnected or send error
+    uint32_t journaled;     // Changes kept in the journal after a failed send
+    uint32_t replayed;      // Journaled changes sent later
+
+    uint32_t messages;      // Messages sent, live and replayed
+    uint32_t events;        // Live states sent in those messages
+    uint32_t bytes;         // Bytes sent
+    uint64_t latency_us;    // Sum of the change to send delays of live states
+    uint32_t latency_max_us;
+
+    callframe_stats_t acks; // Press to ack histogram and retransmits, as in the stats frame
+} telemetry_stats_t;
+
+void telemetry_init(void);
+
+// Sets the websocket client frames are sent on
+void telemetry_set_client(esp_websocket_client_handle_t client);
+
+// Queues 'frame' if it differs from the last frame queued, or if the
+// heartbeat is due. 'timestamp' is when the state changed. Returns true if
+// the frame was queued.
+bool telemetry_offer(const callframe_t *frame, int64_t timestamp);
+
+// Sends the pending batch once its window has passed, handles acks,
+// retransmits and the stats frame
+void telemetry_poll(void);
+
+// Ack received from the server, may be called from any task
+void telemetry_ack(uint16_t seq);
+
+// Forces the next offer to be sent, e.g. after a reconnect
+void telemetry_resync(void);
+
+// Milliseconds until telemetry_poll() or telemetry_offer() has something
+// to do: the batch window ends, or the heartbeat, a retry, a retransmit or
+// the stats frame is due
+uint32_t telemetry_wait_ms(void);
+
+// Copy of the counters, read without locking from other tasks
+void telemetry_get_stats(telemetry_stats_t *stats);
+
+#endif
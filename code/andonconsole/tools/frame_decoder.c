@@ -0,0 +1,130 @@
+/*
+ * Reference decoder for the binary console frames (see main/callframe.h)
+ *
+ * Builds on any host with a C compiler:
+ *
+ *   gcc -Wall -I../main -o frame_decoder frame_decoder.c ../main/callframe.c
+ *
+ * Usage, frames given as hex strings, on the command line or one per line on stdin:
+ *
+ *   ./frame_decoder a5010100393000000200050102030000
+ *   ./frame_decoder < captured_frames.txt
+ *
+ * Prints every frame as the equivalent JSON text frame. A message holding
+ * several frames back to back (a replayed backlog) prints one line per frame.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "callframe.h"
+
+#define MAX_FRAME 2048      // A whole batch of frames
+
+// Converts a hex string into bytes, returns the number of bytes or -1
+static int parse_hex(const char *hex, uint8_t *out, size_t size) {
+    size_t n = 0;
+
+    while (*hex) {
+        if (isspace((unsigned char)*hex)) {
+            hex++;
+            continue;
+        }
+        if (!isxdigit((unsigned char)hex[0]) || !isxdigit((unsigned char)hex[1]) || n >= size) return -1;
+
+        unsigned int byte;
+        sscanf(hex, "%2x", &byte);
+        out[n++] = (uint8_t)byte;
+        hex += 2;
+    }
+    return (int)n;
+}
+
+// Statistics frames, printed as the JSON stats frame
+static int decode_stats(const uint8_t *buf, int len) {
+    char json[512];
+    callframe_stats_t stats;
+    uint32_t consoleid;
+
+    int ret = callframe_stats_decode(buf, len, &consoleid, &stats);
+    if (ret > 0) {
+        callframe_stats_json(consoleid, &stats, json, sizeof(json));
+        printf("%s\n", json);
+    }
+    return ret;
+}
+
+// Decodes and prints one frame, returns its length or a CALLFRAME_ERR_* code
+static int decode_frame(const uint8_t *buf, int len) {
+    callframe_bin_t frame;
+    uint16_t seq;
+    int ret;
+
+    if (len > CALLFRAME_OFS_TYPE && buf[CALLFRAME_OFS_TYPE] == CALLFRAME_TYPE_STATS) {
+        ret = decode_stats(buf, len);
+        if (ret > 0) return ret;
+    } else if (len > CALLFRAME_OFS_TYPE && buf[CALLFRAME_OFS_TYPE] == CALLFRAME_TYPE_ACK) {
+        if (callframe_ack_bin(buf, len, &seq) == 0) {
+            printf("{\"ack\":%u}\n", (unsigned)seq);
+            return CALLFRAME_ACK_LEN;
+        }
+        ret = CALLFRAME_ERR_SHORT;
+    } else {
+        ret = callframe_bin_decode(buf, len, &frame);
+    }
+
+    switch (ret) {
+        case CALLFRAME_ERR_SHORT:   fprintf(stderr, "Frame too short (%d bytes)\n", len);            return ret;
+        case CALLFRAME_ERR_MAGIC:   fprintf(stderr, "Bad magic 0x%02x\n", buf[CALLFRAME_OFS_MAGIC]); return ret;
+        case CALLFRAME_ERR_VERSION: fprintf(stderr, "Unsupported version %d\n", buf[CALLFRAME_OFS_VERSION]); return ret;
+        case CALLFRAME_ERR_TYPE:    fprintf(stderr, "Unknown frame type %d\n", buf[CALLFRAME_OFS_TYPE]); return ret;
+    }
+
+    printf("{\"consoleid\":%u,\"department\":", (unsigned)frame.consoleid);
+    if (frame.department == CALLFRAME_DEPT_UNDEFINED) printf("\"Undefined\"");
+    else printf("\"%u\"", (unsigned)frame.department);
+
+    for (int i = 0; i < CALLFRAME_CALLS; i++) {
+        const char *status = (frame.active & (1 << i)) ? callframe_status_name(frame.status[i]) : "";
+        printf(",\"call%d\":\"%s\"", i + 1, status);
+    }
+    if (frame.oldcall == CALLFRAME_LIVE) printf(",\"oldcall\":\"\"");
+    else printf(",\"oldcall\":\"%ld\"", (long)frame.oldcall);
+    if (frame.seq) printf(",\"seq\":%u", (unsigned)frame.seq);
+    printf("}\n");
+    return ret;
+}
+
+static int decode(const char *hex) {
+    uint8_t buf[MAX_FRAME];
+
+    int len = parse_hex(hex, buf, sizeof(buf));
+    if (len <= 0) {
+        fprintf(stderr, "Not a hex frame: %s\n", hex);
+        return 1;
+    }
+
+    for (int pos = 0; pos < len; ) {
+        int ret = decode_frame(&buf[pos], len - pos);
+        if (ret < 0) return 1;
+        pos += ret;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char line[2 * MAX_FRAME + 2];
+    int errors = 0;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) errors += decode(argv[i]);
+        return errors ? 1 : 0;
+    }
+
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') continue;
+        errors += decode(line);
+    }
+    return errors ? 1 : 0;
+}